@@ -0,0 +1,155 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "atlasallocator.h"
+
+AtlasAllocator::AtlasAllocator(const QSize &size)
+{
+    reset(size);
+}
+
+void AtlasAllocator::reset(const QSize &size)
+{
+    m_size = size;
+    m_shelves.clear();
+    m_nextY = 0;
+}
+
+QRect AtlasAllocator::allocateInShelf(Shelf &shelf, const QSize &size)
+{
+    for (int i = 0; i < shelf.freeSlots.count(); ++i) {
+        QRect &slot(shelf.freeSlots[i]);
+        if (slot.width() >= size.width()) {
+            const QRect rect(slot.topLeft(), size);
+            if (slot.width() == size.width())
+                shelf.freeSlots.removeAt(i);
+            else
+                slot.setLeft(slot.left() + size.width());
+            return rect;
+        }
+    }
+
+    if (shelf.used + size.width() <= m_size.width()) {
+        const QRect rect(QPoint(shelf.used, shelf.y), size);
+        shelf.used += size.width();
+        return rect;
+    }
+
+    return QRect();
+}
+
+// Returns a null rect when the atlas is full.
+QRect AtlasAllocator::allocate(const QSize &size)
+{
+    if (size.isEmpty() || size.width() > m_size.width() || size.height() > m_size.height())
+        return QRect();
+
+    // Prefer shelves that are not much taller than needed, then open a new
+    // one, and only then settle for wasting more height.
+    for (Shelf &shelf : m_shelves) {
+        if (shelf.height >= size.height() && shelf.height <= size.height() + size.height() / 2) {
+            const QRect rect = allocateInShelf(shelf, size);
+            if (!rect.isNull())
+                return rect;
+        }
+    }
+
+    if (m_nextY + size.height() <= m_size.height()) {
+        Shelf shelf = { m_nextY, size.height(), 0, QVector<QRect>() };
+        m_nextY += size.height();
+        m_shelves.append(shelf);
+        return allocateInShelf(m_shelves.last(), size);
+    }
+
+    for (Shelf &shelf : m_shelves) {
+        if (shelf.height >= size.height()) {
+            const QRect rect = allocateInShelf(shelf, size);
+            if (!rect.isNull())
+                return rect;
+        }
+    }
+
+    return QRect();
+}
+
+void AtlasAllocator::release(const QRect &rect)
+{
+    for (int idx = 0; idx < m_shelves.count(); ++idx) {
+        Shelf &shelf(m_shelves[idx]);
+        if (shelf.y != rect.y())
+            continue;
+
+        if (rect.right() + 1 == shelf.used) {
+            shelf.used = rect.left();
+            // Give back trailing free slots as well.
+            bool shrunk = true;
+            while (shrunk) {
+                shrunk = false;
+                for (int i = 0; i < shelf.freeSlots.count(); ++i) {
+                    if (shelf.freeSlots[i].right() + 1 == shelf.used) {
+                        shelf.used = shelf.freeSlots[i].left();
+                        shelf.freeSlots.removeAt(i);
+                        shrunk = true;
+                        break;
+                    }
+                }
+            }
+        } else {
+            shelf.freeSlots.append(QRect(rect.x(), shelf.y, rect.width(), shelf.height));
+        }
+
+        // Empty shelves at the bottom can be reopened with another height.
+        while (!m_shelves.isEmpty() && m_shelves.last().used == 0) {
+            m_nextY = m_shelves.last().y;
+            m_shelves.removeLast();
+        }
+        return;
+    }
+}
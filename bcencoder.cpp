@@ -0,0 +1,227 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "bcencoder.h"
+#include <QtCore/private/qsimd_p.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BCENCODER_NEON
+#endif
+
+// Per channel minimum and maximum of the 16 pixels of a block, the
+// endpoints of both the alpha and the color part.
+static inline void blockBounds(const quint32 *block, quint32 *minColor, quint32 *maxColor)
+{
+#if defined(__SSE2__)
+    const __m128i *p = reinterpret_cast<const __m128i *>(block);
+    __m128i mn = _mm_min_epu8(_mm_min_epu8(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                              _mm_min_epu8(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    __m128i mx = _mm_max_epu8(_mm_max_epu8(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                              _mm_max_epu8(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+    *minColor = quint32(_mm_cvtsi128_si32(mn));
+    *maxColor = quint32(_mm_cvtsi128_si32(mx));
+#elif defined(BCENCODER_NEON)
+    const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t *>(block));
+    const uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t *>(block + 4));
+    const uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t *>(block + 8));
+    const uint8x16_t d = vld1q_u8(reinterpret_cast<const uint8_t *>(block + 12));
+    const uint8x16_t mn16 = vminq_u8(vminq_u8(a, b), vminq_u8(c, d));
+    const uint8x16_t mx16 = vmaxq_u8(vmaxq_u8(a, b), vmaxq_u8(c, d));
+    uint8x8_t mn = vmin_u8(vget_low_u8(mn16), vget_high_u8(mn16));
+    uint8x8_t mx = vmax_u8(vget_low_u8(mx16), vget_high_u8(mx16));
+    mn = vmin_u8(mn, vreinterpret_u8_u32(vrev64_u32(vreinterpret_u32_u8(mn))));
+    mx = vmax_u8(mx, vreinterpret_u8_u32(vrev64_u32(vreinterpret_u32_u8(mx))));
+    *minColor = vget_lane_u32(vreinterpret_u32_u8(mn), 0);
+    *maxColor = vget_lane_u32(vreinterpret_u32_u8(mx), 0);
+#else
+    quint32 mn = 0xffffffff;
+    quint32 mx = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        quint32 cmin = 255;
+        quint32 cmax = 0;
+        for (int i = 0; i < 16; ++i) {
+            const quint32 c = (block[i] >> shift) & 0xff;
+            cmin = qMin(cmin, c);
+            cmax = qMax(cmax, c);
+        }
+        mn = (mn & ~(0xffu << shift)) | (cmin << shift);
+        mx = (mx & ~(0xffu << shift)) | (cmax << shift);
+    }
+    *minColor = mn;
+    *maxColor = mx;
+#endif
+}
+
+static inline quint16 to565(quint32 argb)
+{
+    return quint16(((argb >> 8) & 0xf800) | ((argb >> 5) & 0x07e0) | ((argb >> 3) & 0x001f));
+}
+
+static inline void from565(quint16 c, int *rgb)
+{
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+}
+
+static void encodeAlpha(uchar *dst, const quint32 *block, int a0, int a1)
+{
+    dst[0] = uchar(a0);
+    dst[1] = uchar(a1);
+    quint64 bits = 0;
+    if (a0 > a1) {
+        // Index 0 is a0, 1 is a1, 2..7 step from a0 towards a1.
+        static const int levelToIndex[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+        const int range = a0 - a1;
+        for (int i = 0; i < 16; ++i) {
+            const int a = int(block[i] >> 24);
+            const int level = ((a - a1) * 7 + range / 2) / range;
+            bits |= quint64(levelToIndex[level]) << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; ++i)
+        dst[2 + i] = uchar(bits >> (8 * i));
+}
+
+static void encodeColor(uchar *dst, const quint32 *block, quint32 minColor, quint32 maxColor)
+{
+    // Pull the endpoints in a bit, the extremes are rarely worth a full
+    // palette entry each.
+    int mn[3], mx[3];
+    for (int c = 0; c < 3; ++c) {
+        const int shift = 16 - 8 * c;
+        const int lo = int((minColor >> shift) & 0xff);
+        const int hi = int((maxColor >> shift) & 0xff);
+        const int inset = (hi - lo) >> 4;
+        mn[c] = lo + inset;
+        mx[c] = hi - inset;
+    }
+    const quint32 c0 = quint32(mx[0] << 16 | mx[1] << 8 | mx[2]);
+    const quint32 c1 = quint32(mn[0] << 16 | mn[1] << 8 | mn[2]);
+    const quint16 e0 = to565(c0);
+    const quint16 e1 = to565(c1);
+
+    // Project onto the line between the quantized endpoints.
+    int p0[3], p1[3];
+    from565(e0, p0);
+    from565(e1, p1);
+    const int axis[3] = { p0[0] - p1[0], p0[1] - p1[1], p0[2] - p1[2] };
+    const int len = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+    quint32 bits = 0;
+    if (len > 0 && e0 != e1) {
+        // Index 0 is e0, 1 is e1, 2 and 3 are at 1/3 and 2/3 towards e1.
+        static const int levelToIndex[4] = { 1, 3, 2, 0 };
+        for (int i = 0; i < 16; ++i) {
+            const int d = (int((block[i] >> 16) & 0xff) - p1[0]) * axis[0]
+                    + (int((block[i] >> 8) & 0xff) - p1[1]) * axis[1]
+                    + (int(block[i] & 0xff) - p1[2]) * axis[2];
+            const int level = qBound(0, (d * 3 + len / 2) / len, 3);
+            bits |= quint32(levelToIndex[level]) << (2 * i);
+        }
+    }
+
+    // e0 > e1 selects the four color mode, which BC3 always uses anyway.
+    dst[0] = uchar(e0);
+    dst[1] = uchar(e0 >> 8);
+    dst[2] = uchar(e1);
+    dst[3] = uchar(e1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        dst[4 + i] = uchar(bits >> (8 * i));
+}
+
+size_t bc3EncodedSize(const QRect &rect)
+{
+    return size_t((rect.width() + 3) / 4) * size_t((rect.height() + 3) / 4) * 16;
+}
+
+void encodeBC3(uchar *dst, const QImage &img, const QRect &rect)
+{
+    const int maxX = img.width() - 1;
+    const int maxY = img.height() - 1;
+    quint32 block[16];
+
+    for (int by = rect.top(); by <= rect.bottom(); by += 4) {
+        for (int bx = rect.left(); bx <= rect.right(); bx += 4) {
+            const bool inside = bx + 3 <= maxX && by + 3 <= maxY;
+            for (int y = 0; y < 4; ++y) {
+                const quint32 *line = reinterpret_cast<const quint32 *>(img.constScanLine(qMin(by + y, maxY)));
+                if (inside) {
+                    memcpy(block + 4 * y, line + bx, 16);
+                } else {
+                    for (int x = 0; x < 4; ++x)
+                        block[4 * y + x] = line[qMin(bx + x, maxX)];
+                }
+            }
+
+            quint32 minColor, maxColor;
+            blockBounds(block, &minColor, &maxColor);
+            encodeAlpha(dst, block, int(maxColor >> 24), int(minColor >> 24));
+            encodeColor(dst + 8, block, minColor, maxColor);
+            dst += 16;
+        }
+    }
+}
+
+const char *bcEncoderKernelName()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(BCENCODER_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,15 @@
+TEMPLATE = app
+TARGET = sw_quick_bench
+
+QT = core gui qml quick quick-private core-private
+
+INCLUDEPATH += ..
+
+SOURCES = \
+    main.cpp \
+    ../rectcopy.cpp
+
+HEADERS = \
+    ../rectcopy.h
+
+RESOURCES = benchmark.qrc
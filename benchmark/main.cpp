@@ -0,0 +1,323 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Headless benchmark for the Quick to texture path: renders QML scenes with
+// the software backend into a QImage, like VulkanWindowWithSwQuick does, and
+// copies the dirty areas into host memory laid out like the texture upload
+// source. Vulkan itself is not involved, so this runs on the offscreen
+// platform plugin without any GPU.
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QQuickRenderControl>
+#include <QQuickWindow>
+#include <QQuickItem>
+#include <QQmlEngine>
+#include <QQmlComponent>
+#include <QAnimationDriver>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <QScopedPointer>
+#include <QVector>
+#include <QtQuick/private/qquickwindow_p.h>
+#include <QtQuick/private/qsgsoftwarerenderer_p.h>
+#include <algorithm>
+#include "rectcopy.h"
+
+// Advances animations by a fixed step per frame, independently of how long
+// rendering takes, so that runs are comparable.
+class AnimationDriver : public QAnimationDriver
+{
+public:
+    AnimationDriver(int msPerStep) : m_step(msPerStep) { }
+
+    void advance() override
+    {
+        m_elapsed += m_step;
+        advanceAnimation();
+    }
+
+    qint64 elapsed() const override { return m_elapsed; }
+
+private:
+    int m_step;
+    qint64 m_elapsed = 0;
+};
+
+struct FrameStats
+{
+    QVector<double> polish;
+    QVector<double> sync;
+    QVector<double> render;
+    QVector<double> upload;
+    QVector<double> frame;
+    QVector<double> dirtyPixels;
+    QVector<double> uploadBytes;
+};
+
+static QJsonObject summarize(QVector<double> v)
+{
+    QJsonObject o;
+    if (v.isEmpty())
+        return o;
+
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (double d : qAsConst(v))
+        sum += d;
+    auto percentile = [&v](double p) { return v[qMin(v.count() - 1, int(p * v.count()))]; };
+
+    o.insert(QStringLiteral("mean"), sum / v.count());
+    o.insert(QStringLiteral("min"), v.first());
+    o.insert(QStringLiteral("p50"), percentile(0.5));
+    o.insert(QStringLiteral("p90"), percentile(0.9));
+    o.insert(QStringLiteral("p99"), percentile(0.99));
+    o.insert(QStringLiteral("max"), v.last());
+    return o;
+}
+
+static inline double msecsSince(const QElapsedTimer &t, qint64 start)
+{
+    return (t.nsecsElapsed() - start) / 1000000.0;
+}
+
+// Staging buffers are tightly packed, linear images typically have their
+// rows aligned.
+static bool runScene(const QString &fileName, const QSize &size, int frames, int warmupFrames,
+                     size_t rowAlign, AnimationDriver *animationDriver, FrameStats *stats)
+{
+    QQuickRenderControl renderControl;
+    QQuickWindow quickWindow(&renderControl);
+    quickWindow.setColor(Qt::transparent);
+    quickWindow.setGeometry(0, 0, size.width(), size.height());
+
+    QQmlEngine engine;
+    if (!engine.incubationController())
+        engine.setIncubationController(quickWindow.incubationController());
+
+    QQmlComponent component(&engine, QUrl(fileName));
+    while (component.isLoading())
+        QCoreApplication::processEvents();
+
+    QScopedPointer<QObject> rootObject(component.create());
+    QQuickItem *rootItem = qobject_cast<QQuickItem *>(rootObject.data());
+    if (component.isError() || !rootItem) {
+        const QList<QQmlError> errorList = component.errors();
+        for (const QQmlError &error : errorList)
+            qWarning() << error.url() << error.line() << error;
+        return false;
+    }
+
+    rootItem->setParentItem(quickWindow.contentItem());
+    rootItem->setWidth(size.width());
+    rootItem->setHeight(size.height());
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    const size_t pitch = (size_t(size.width()) * 4 + rowAlign - 1) / rowAlign * rowAlign;
+    QByteArray uploadMemory(int(pitch * size.height()), Qt::Uninitialized);
+
+    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(&quickWindow);
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int i = 0; i < warmupFrames + frames; ++i) {
+        animationDriver->advance();
+        QCoreApplication::processEvents();
+
+        const qint64 frameStart = timer.nsecsElapsed();
+        qint64 t = frameStart;
+        renderControl.polishItems();
+        const double polishTime = msecsSince(timer, t);
+
+        t = timer.nsecsElapsed();
+        renderControl.sync();
+        const double syncTime = msecsSince(timer, t);
+
+        t = timer.nsecsElapsed();
+        QSGSoftwareRenderer *r = static_cast<QSGSoftwareRenderer *>(wd->renderer);
+        r->setCurrentPaintDevice(&image);
+        renderControl.render();
+        const double renderTime = msecsSince(timer, t);
+
+        const QRegion dirtyRegion = r->flushRegion();
+        t = timer.nsecsElapsed();
+        const QVector<QRect> rects = coalesceDirtyRects(dirtyRegion, 4);
+        copyDirtyRects(reinterpret_cast<uchar *>(uploadMemory.data()), pitch, image, rects);
+        const double uploadTime = msecsSince(timer, t);
+        const double frameTime = msecsSince(timer, frameStart);
+
+        if (i < warmupFrames)
+            continue;
+
+        double dirtyPixels = 0;
+        for (const QRect &rect : dirtyRegion)
+            dirtyPixels += double(rect.width()) * rect.height();
+        double uploadBytes = 0;
+        for (const QRect &rect : rects)
+            uploadBytes += double(rect.width()) * rect.height() * 4;
+
+        stats->polish.append(polishTime);
+        stats->sync.append(syncTime);
+        stats->render.append(renderTime);
+        stats->upload.append(uploadTime);
+        stats->frame.append(frameTime);
+        stats->dirtyPixels.append(dirtyPixels);
+        stats->uploadBytes.append(uploadBytes);
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // No window system and no GPU needed.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser cmdLineParser;
+    cmdLineParser.setApplicationDescription(QStringLiteral("Benchmarks rendering Qt Quick scenes with the software backend and copying the dirty areas for upload. Results are written as JSON."));
+    cmdLineParser.addHelpOption();
+    QCommandLineOption framesOption(QStringLiteral("frames"),
+                                    QStringLiteral("Number of measured frames per scene"),
+                                    QStringLiteral("count"), QStringLiteral("300"));
+    cmdLineParser.addOption(framesOption);
+    QCommandLineOption warmupOption(QStringLiteral("warmup"),
+                                    QStringLiteral("Number of frames to render before measuring"),
+                                    QStringLiteral("count"), QStringLiteral("30"));
+    cmdLineParser.addOption(warmupOption);
+    QCommandLineOption sizeOption(QStringLiteral("size"),
+                                  QStringLiteral("Size of the Qt Quick scene, <width>x<height>"),
+                                  QStringLiteral("size"), QStringLiteral("512x512"));
+    cmdLineParser.addOption(sizeOption);
+    QCommandLineOption uploadOption(QStringLiteral("upload"),
+                                    QStringLiteral("Upload memory layout: linear (rows aligned to 256 bytes) or staging (packed)"),
+                                    QStringLiteral("mode"), QStringLiteral("linear"));
+    cmdLineParser.addOption(uploadOption);
+    QCommandLineOption outputOption(QStringLiteral("output"),
+                                    QStringLiteral("Write the results to <file> instead of stdout"),
+                                    QStringLiteral("file"));
+    cmdLineParser.addOption(outputOption);
+    cmdLineParser.addPositionalArgument(QStringLiteral("scenes"),
+                                        QStringLiteral("QML files or URLs to run, the built-in scenes by default"));
+    cmdLineParser.process(app);
+
+    const int frames = qMax(1, cmdLineParser.value(framesOption).toInt());
+    const int warmupFrames = qMax(0, cmdLineParser.value(warmupOption).toInt());
+    const QStringList dims = cmdLineParser.value(sizeOption).split(QLatin1Char('x'));
+    if (dims.count() != 2 || dims[0].toInt() <= 0 || dims[1].toInt() <= 0)
+        qFatal("Invalid scene size %s", qPrintable(cmdLineParser.value(sizeOption)));
+    const QSize size(dims[0].toInt(), dims[1].toInt());
+    const bool staging = cmdLineParser.value(uploadOption) == QStringLiteral("staging");
+
+    QStringList scenes;
+    for (const QString &arg : cmdLineParser.positionalArguments())
+        scenes.append(QUrl::fromUserInput(arg, QDir::currentPath()).toString());
+    if (scenes.isEmpty()) {
+        scenes << QStringLiteral("qrc:/static.qml")
+               << QStringLiteral("qrc:/rotatingsquare.qml")
+               << QStringLiteral("qrc:/manyitems.qml")
+               << QStringLiteral("qrc:/fullscreen.qml");
+    }
+
+    AnimationDriver animationDriver(16);
+    animationDriver.install();
+
+    QJsonArray results;
+    for (const QString &scene : qAsConst(scenes)) {
+        FrameStats stats;
+        if (!runScene(scene, size, frames, warmupFrames, staging ? 4 : 256, &animationDriver, &stats)) {
+            qWarning("Failed to run %s", qPrintable(scene));
+            continue;
+        }
+
+        QJsonObject result;
+        result.insert(QStringLiteral("scene"), scene);
+        result.insert(QStringLiteral("polishMs"), summarize(stats.polish));
+        result.insert(QStringLiteral("syncMs"), summarize(stats.sync));
+        result.insert(QStringLiteral("renderMs"), summarize(stats.render));
+        result.insert(QStringLiteral("uploadMs"), summarize(stats.upload));
+        result.insert(QStringLiteral("frameMs"), summarize(stats.frame));
+        result.insert(QStringLiteral("dirtyPixels"), summarize(stats.dirtyPixels));
+        result.insert(QStringLiteral("uploadBytes"), summarize(stats.uploadBytes));
+        results.append(result);
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("platform"), QGuiApplication::platformName());
+    root.insert(QStringLiteral("copyKernel"), QString::fromLatin1(rectCopyKernelName()));
+    root.insert(QStringLiteral("upload"), staging ? QStringLiteral("staging") : QStringLiteral("linear"));
+    root.insert(QStringLiteral("width"), size.width());
+    root.insert(QStringLiteral("height"), size.height());
+    root.insert(QStringLiteral("frames"), frames);
+    root.insert(QStringLiteral("results"), results);
+    const QByteArray json = QJsonDocument(root).toJson();
+
+    if (cmdLineParser.isSet(outputOption)) {
+        QFile file(cmdLineParser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly))
+            qFatal("Failed to open %s", qPrintable(file.fileName()));
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return results.isEmpty() ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "framepacer.h"
+
+static const qint64 MSEC = 1000000;
+// Intervals outside of this are not from a display's refresh.
+static const qint64 MIN_PERIOD = 4 * MSEC;
+static const qint64 MAX_PERIOD = 50 * MSEC;
+static const qint64 MIN_MARGIN = 1 * MSEC;
+// The margin shrinks again after this many frames in a row on time.
+static const int MARGIN_DECAY_FRAMES = 60;
+
+// Exponential moving average with a weight of 1/8 for the new value.
+static inline qint64 average(qint64 avg, qint64 value)
+{
+    return avg ? avg + (value - avg) / 8 : value;
+}
+
+bool FramePacer::beginFrame(qint64 start)
+{
+    const qint64 interval = m_frameStart >= 0 ? start - m_frameStart : 0;
+    m_frameStart = start;
+
+    // A gap of several periods is an idle stretch, not a late frame.
+    m_paced = m_period && interval < 3 * m_period;
+    if (interval >= MIN_PERIOD && interval <= MAX_PERIOD && (!m_period || interval < 3 * m_period))
+        m_period = average(m_period, interval);
+
+    if (!m_paced)
+        return false;
+
+    const bool late = interval > m_period + m_period / 2;
+    countFrame(late);
+    return late;
+}
+
+bool FramePacer::beginLatchedFrame(qint64 start, qint64 latch)
+{
+    m_frameStart += m_period;
+
+    const bool late = start - latch > qMax(m_margin, MIN_MARGIN);
+    countFrame(late);
+    if (late)
+        m_paced = false;
+    return late;
+}
+
+void FramePacer::countFrame(bool late)
+{
+    if (late) {
+        m_margin = qMin(m_margin + MSEC, m_period / 2);
+        m_onTimeFrames = 0;
+        return;
+    }
+
+    if (++m_onTimeFrames >= MARGIN_DECAY_FRAMES) {
+        m_margin = qMax(MIN_MARGIN, m_margin - MSEC / 2);
+        m_onTimeFrames = 0;
+    }
+}
+
+qint64 FramePacer::latchOffset() const
+{
+    return qMax<qint64>(0, m_period - m_work - qMax(m_margin, MIN_MARGIN));
+}
+
+qint64 FramePacer::nextLatchTime() const
+{
+    if (!m_paced)
+        return -1;
+    return m_frameStart + m_period + latchOffset();
+}
+
+void FramePacer::endFrame(qint64 latched, qint64 end)
+{
+    m_work = average(m_work, end - latched);
+}
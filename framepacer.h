@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <QtGlobal>
+
+// Estimates when the next frame has to be done by, from the intervals
+// between frame starts, which FIFO presentation ties to the display's
+// refresh rate, and how long the work from the latch point to the end of a
+// frame takes. Frames that start later than expected count as late and
+// make it latch earlier. A frame held back until its latch time does not
+// tell when it could have started, so it is assumed to be one period after
+// the previous one. All times are in nanoseconds, from the profiler's
+// clock.
+class FramePacer
+{
+public:
+    // Returns true when this frame started late.
+    bool beginFrame(qint64 start);
+    // For a frame whose start was held back until a time returned by
+    // nextLatchTime(). It counts as late when it started later than that
+    // by more than the margin, and the next frame then starts right away to
+    // pick up the display's rhythm again.
+    bool beginLatchedFrame(qint64 start, qint64 latch);
+    // The time to start the frame after this one at, so that it is done just
+    // before the one after that would start. -1 when there is no estimate,
+    // such as after an idle period in on-demand mode or a late frame.
+    qint64 nextLatchTime() const;
+    void endFrame(qint64 latched, qint64 end);
+
+    qint64 period() const { return m_period; }
+
+private:
+    void countFrame(bool late);
+    qint64 latchOffset() const;
+
+    qint64 m_frameStart = -1;
+    qint64 m_period = 0;
+    qint64 m_work = 0;
+    qint64 m_margin = 0;
+    int m_onTimeFrames = 0;
+    bool m_paced = false;
+};
+
+#endif
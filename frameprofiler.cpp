@@ -0,0 +1,282 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "frameprofiler.h"
+#include <QThread>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+Q_LOGGING_CATEGORY(lcFrameStats, "swquick.stats", QtWarningMsg)
+
+static const char *stageNames[] = {
+    "polish",
+    "sync",
+    "render",
+    "upload",
+    "record",
+    "frame",
+    "gpu",
+    "input"
+};
+
+// Trace "threads": the GUI thread, the Quick render thread, the GPU, and
+// input latencies, which overlap the frames.
+enum { GuiTid = 1, RenderTid = 2, GpuTid = 3, InputTid = 4 };
+
+FrameProfiler::FrameProfiler()
+    : m_guiThread(QThread::currentThread())
+{
+    m_timer.start();
+    for (int i = 0; i < FRAME_START_HISTORY; ++i)
+        m_frameStartHistory[i] = -1;
+}
+
+void FrameProfiler::beginFrame(quint64 frame)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current = FrameStats();
+    m_current.frame = frame;
+    m_current.gpuFrame = m_last.gpuFrame;
+    m_current.gpuMs = m_last.gpuMs;
+    m_current.skippedRenders = m_last.skippedRenders;
+    m_current.wastedRenders = m_last.wastedRenders;
+    m_current.lateFrames = m_last.lateFrames;
+    m_frameStart = now();
+    m_oldestInput = -1;
+    m_latched = -1;
+    m_frameStartHistory[frame % FRAME_START_HISTORY] = m_frameStart;
+}
+
+void FrameProfiler::endFrame()
+{
+    const qint64 end = now();
+
+    QMutexLocker lock(&m_mutex);
+    m_current.frameMs = (end - m_frameStart) / 1000000.0;
+    addTraceEvent(Frame, GuiTid, m_frameStart, end - m_frameStart);
+    if (m_oldestInput >= 0) {
+        m_current.inputLatencyMs = (end - m_oldestInput) / 1000000.0;
+        addTraceEvent(Input, InputTid, m_oldestInput, end - m_oldestInput);
+    }
+    if (m_latched >= 0)
+        m_current.quickLatencyMs = (end - m_latched) / 1000000.0;
+    m_last = m_current;
+    lock.unlock();
+
+    qCDebug(lcFrameStats, "frame %llu: polish %.2f sync %.2f render %.2f upload %.2f record %.2f total %.2f ms, "
+                          "gpu %.2f ms (frame %llu), %lld dirty pixels, %lld bytes uploaded, "
+                          "%llu skipped and %llu wasted renders so far, %d input events with %.2f ms latency, "
+                          "latched after %.2f ms with %.2f ms to present, %llu late frames so far, "
+                          "%lld pixels redrawn and %lld damaged",
+            m_last.frame, m_last.polishMs, m_last.syncMs, m_last.renderMs, m_last.uploadMs,
+            m_last.recordMs, m_last.frameMs, m_last.gpuMs, m_last.gpuFrame,
+            m_last.dirtyPixels, m_last.uploadBytes, m_last.skippedRenders, m_last.wastedRenders,
+            m_last.inputEvents, m_last.inputLatencyMs, m_last.latchWaitMs, m_last.quickLatencyMs,
+            m_last.lateFrames, m_last.redrawnPixels, m_last.damagedPixels);
+}
+
+void FrameProfiler::addStage(Stage stage, qint64 start, qint64 end)
+{
+    const double ms = (end - start) / 1000000.0;
+    const int tid = QThread::currentThread() == m_guiThread ? GuiTid : RenderTid;
+
+    QMutexLocker lock(&m_mutex);
+    switch (stage) {
+    case Polish:
+        m_current.polishMs += ms;
+        break;
+    case Sync:
+        m_current.syncMs += ms;
+        break;
+    case Render:
+        m_current.renderMs += ms;
+        break;
+    case Upload:
+        m_current.uploadMs += ms;
+        break;
+    case Record:
+        m_current.recordMs += ms;
+        break;
+    default:
+        break;
+    }
+    addTraceEvent(stage, tid, start, end - start);
+}
+
+// There is no common time base with the GPU, the event is placed at the
+// start of the frame it belongs to.
+void FrameProfiler::addGpuTime(quint64 frame, double ms)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.gpuFrame = frame;
+    m_current.gpuMs = ms;
+
+    const qint64 start = m_frameStartHistory[frame % FRAME_START_HISTORY];
+    if (start >= 0)
+        addTraceEvent(Gpu, GpuTid, start, qint64(ms * 1000000.0));
+}
+
+void FrameProfiler::addDirtyPixels(qint64 pixels)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.dirtyPixels += pixels;
+}
+
+void FrameProfiler::addUploadBytes(qint64 bytes)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.uploadBytes += bytes;
+}
+
+void FrameProfiler::addSkippedRender()
+{
+    QMutexLocker lock(&m_mutex);
+    ++m_current.skippedRenders;
+}
+
+void FrameProfiler::addWastedRender()
+{
+    QMutexLocker lock(&m_mutex);
+    ++m_current.wastedRenders;
+}
+
+// The latency is only known once the frame ends, measured from the oldest
+// event of all batches delivered during the frame.
+void FrameProfiler::addInputEvents(int count, qint64 oldestArrival)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.inputEvents += count;
+    if (m_oldestInput < 0 || oldestArrival < m_oldestInput)
+        m_oldestInput = oldestArrival;
+}
+
+void FrameProfiler::addLatch(qint64 waitStart, qint64 latched)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.latchWaitMs = (latched - waitStart) / 1000000.0;
+    m_latched = latched;
+}
+
+void FrameProfiler::addLateFrame()
+{
+    QMutexLocker lock(&m_mutex);
+    ++m_current.lateFrames;
+}
+
+void FrameProfiler::addDamage(qint64 redrawnPixels, qint64 damagedPixels)
+{
+    QMutexLocker lock(&m_mutex);
+    m_current.redrawnPixels += redrawnPixels;
+    m_current.damagedPixels += damagedPixels;
+}
+
+FrameStats FrameProfiler::lastFrameStats() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_last;
+}
+
+void FrameProfiler::addTraceEvent(Stage stage, int tid, qint64 start, qint64 duration)
+{
+    if (!m_traceEnabled || m_trace.count() >= MAX_TRACE_EVENTS)
+        return;
+
+    TraceEvent e = { stage, tid, start, duration };
+    m_trace.append(e);
+}
+
+// Writes the Trace Event Format's JSON object form, with complete ("X")
+// events in microseconds.
+bool FrameProfiler::writeTrace(const QString &fileName) const
+{
+    QJsonArray events;
+
+    static const char *threadNames[] = { "GUI thread", "Quick render thread", "GPU", "Input" };
+    for (int tid = GuiTid; tid <= InputTid; ++tid) {
+        QJsonObject args;
+        args.insert(QStringLiteral("name"), QString::fromLatin1(threadNames[tid - GuiTid]));
+        QJsonObject meta;
+        meta.insert(QStringLiteral("name"), QStringLiteral("thread_name"));
+        meta.insert(QStringLiteral("ph"), QStringLiteral("M"));
+        meta.insert(QStringLiteral("pid"), 1);
+        meta.insert(QStringLiteral("tid"), tid);
+        meta.insert(QStringLiteral("args"), args);
+        events.append(meta);
+    }
+
+    {
+        QMutexLocker lock(&m_mutex);
+        for (const TraceEvent &e : m_trace) {
+            QJsonObject o;
+            o.insert(QStringLiteral("name"), QString::fromLatin1(stageNames[e.stage]));
+            o.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            o.insert(QStringLiteral("pid"), 1);
+            o.insert(QStringLiteral("tid"), e.tid);
+            o.insert(QStringLiteral("ts"), e.start / 1000.0);
+            o.insert(QStringLiteral("dur"), e.duration / 1000.0);
+            events.append(o);
+        }
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("traceEvents"), events);
+    root.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning("Failed to open trace file %s: %s", qPrintable(fileName), qPrintable(file.errorString()));
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    qDebug("Wrote %d trace events to %s", m_trace.count(), qPrintable(fileName));
+    return true;
+}
@@ -0,0 +1,184 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QVector>
+
+class QThread;
+
+Q_DECLARE_LOGGING_CATEGORY(lcFrameStats)
+
+// Timings of one Vulkan frame, in milliseconds. The GPU time arrives a few
+// frames late, gpuFrame tells which frame it belongs to (0 when unknown).
+struct FrameStats
+{
+    quint64 frame = 0;
+    double polishMs = 0;
+    double syncMs = 0;
+    double renderMs = 0;
+    double uploadMs = 0;
+    double recordMs = 0;
+    double frameMs = 0;
+    quint64 gpuFrame = 0;
+    double gpuMs = 0;
+    qint64 dirtyPixels = 0;
+    qint64 uploadBytes = 0;
+    // Totals since the start. Skipped renders are Quick frames that synced
+    // without changing the scene graph, so the raster pass and upload were
+    // left out. Wasted renders did change it, but painted nothing.
+    quint64 skippedRenders = 0;
+    quint64 wastedRenders = 0;
+    // Input events delivered to the Quick scenes this frame, and the time
+    // from the oldest one arriving at the window to the frame being queued
+    // for presentation.
+    int inputEvents = 0;
+    double inputLatencyMs = 0;
+    // Time spent waiting for the latch point with late latching, and from
+    // there, where input is delivered and the Quick scene rendered, to the
+    // frame being queued for presentation. Late frames, a total since the
+    // start, began well after the expected frame period.
+    double latchWaitMs = 0;
+    double quickLatencyMs = 0;
+    quint64 lateFrames = 0;
+    // Swapchain pixels inside the render area, and inside the damage handed
+    // to the presentation engine. Both cover the whole image unless damage
+    // tracking is on.
+    qint64 redrawnPixels = 0;
+    qint64 damagedPixels = 0;
+};
+
+// Collects per-stage CPU timings, GPU timings and counters for each frame.
+// Stages may be reported from the Quick render thread too, those count
+// towards the frame during which they finished. Optionally records
+// everything as Chrome trace events (chrome://tracing, Perfetto).
+class FrameProfiler
+{
+public:
+    enum Stage {
+        Polish,
+        Sync,
+        Render,
+        Upload,
+        Record,
+        Frame,
+        Gpu,
+        Input
+    };
+
+    FrameProfiler();
+
+    void setTraceEnabled(bool enable) { m_traceEnabled = enable; }
+    bool isTraceEnabled() const { return m_traceEnabled; }
+
+    qint64 now() const { return m_timer.nsecsElapsed(); }
+
+    void beginFrame(quint64 frame);
+    void endFrame();
+    void addStage(Stage stage, qint64 start, qint64 end);
+    void addGpuTime(quint64 frame, double ms);
+    void addDirtyPixels(qint64 pixels);
+    void addUploadBytes(qint64 bytes);
+    void addSkippedRender();
+    void addWastedRender();
+    // oldestArrival is in now()'s time base.
+    void addInputEvents(int count, qint64 oldestArrival);
+    void addLatch(qint64 waitStart, qint64 latched);
+    void addLateFrame();
+    void addDamage(qint64 redrawnPixels, qint64 damagedPixels);
+
+    FrameStats lastFrameStats() const;
+    bool writeTrace(const QString &fileName) const;
+
+private:
+    struct TraceEvent {
+        Stage stage;
+        int tid;
+        qint64 start;
+        qint64 duration;
+    };
+
+    void addTraceEvent(Stage stage, int tid, qint64 start, qint64 duration);
+
+    static const int MAX_TRACE_EVENTS = 1 << 20;
+    static const int FRAME_START_HISTORY = 16;
+
+    QElapsedTimer m_timer;
+    QThread *m_guiThread;
+    bool m_traceEnabled = false;
+
+    mutable QMutex m_mutex;
+    FrameStats m_current;
+    FrameStats m_last;
+    qint64 m_frameStart = 0;
+    qint64 m_oldestInput = -1;
+    qint64 m_latched = -1;
+    qint64 m_frameStartHistory[FRAME_START_HISTORY];
+    QVector<TraceEvent> m_trace;
+};
+
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(FrameProfiler *profiler, FrameProfiler::Stage stage)
+        : m_profiler(profiler), m_stage(stage), m_start(profiler->now()) { }
+    ~ScopedStageTimer() { m_profiler->addStage(m_stage, m_start, m_profiler->now()); }
+
+private:
+    FrameProfiler *m_profiler;
+    FrameProfiler::Stage m_stage;
+    qint64 m_start;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "gpumemory.h"
+#include <QVulkanFunctions>
+#include <QDebug>
+
+static inline VkDeviceSize aligned(VkDeviceSize v, VkDeviceSize byteAlign)
+{
+    return (v + byteAlign - 1) & ~(byteAlign - 1);
+}
+
+void GpuMemoryAllocator::create(QVulkanDeviceFunctions *devFuncs, VkDevice dev,
+                                const VkPhysicalDeviceMemoryProperties &memProps,
+                                const VkPhysicalDeviceLimits &limits)
+{
+    m_devFuncs = devFuncs;
+    m_dev = dev;
+    m_memProps = memProps;
+    m_granularity = qMax<VkDeviceSize>(1, limits.bufferImageGranularity);
+    m_nonCoherentAtomSize = qMax<VkDeviceSize>(1, limits.nonCoherentAtomSize);
+}
+
+void GpuMemoryAllocator::destroy()
+{
+    for (int i = 0; i < m_blocks.count(); ++i) {
+        if (!m_blocks[i].memory)
+            continue;
+        if (m_blocks[i].allocationCount)
+            qWarning("Releasing a memory block with %d allocations left", m_blocks[i].allocationCount);
+        releaseBlock(i);
+    }
+    m_blocks.clear();
+}
+
+int GpuMemoryAllocator::createBlock(VkDeviceSize size, uint32_t memIndex, ResourceKind kind, bool dedicated)
+{
+    VkMemoryAllocateInfo allocInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        nullptr,
+        size,
+        memIndex
+    };
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult err = m_devFuncs->vkAllocateMemory(m_dev, &allocInfo, nullptr, &memory);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to allocate %llu bytes of memory type %u: %d", quint64(size), memIndex, err);
+        return -1;
+    }
+
+    // Host visible blocks stay mapped for their lifetime, a memory object
+    // can only be mapped once.
+    uchar *ptr = nullptr;
+    if (m_memProps.memoryTypes[memIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        err = m_devFuncs->vkMapMemory(m_dev, memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void **>(&ptr));
+        if (err != VK_SUCCESS) {
+            qWarning("Failed to map memory: %d", err);
+            m_devFuncs->vkFreeMemory(m_dev, memory, nullptr);
+            return -1;
+        }
+    }
+
+    Block b;
+    b.memory = memory;
+    b.size = size;
+    b.memIndex = memIndex;
+    b.kind = kind;
+    b.dedicated = dedicated;
+    b.ptr = ptr;
+    b.allocationCount = 0;
+    const Range all = { 0, size };
+    b.freeRanges.append(all);
+
+    int index = 0;
+    while (index < m_blocks.count() && m_blocks[index].memory)
+        ++index;
+    if (index == m_blocks.count())
+        m_blocks.append(b);
+    else
+        m_blocks[index] = b;
+
+    qDebug("allocated %s memory block of %llu bytes, memory type %u",
+           dedicated ? "dedicated" : "shared", quint64(size), memIndex);
+    return index;
+}
+
+void GpuMemoryAllocator::releaseBlock(int index)
+{
+    Block &b(m_blocks[index]);
+    if (b.ptr)
+        m_devFuncs->vkUnmapMemory(m_dev, b.memory);
+    m_devFuncs->vkFreeMemory(m_dev, b.memory, nullptr);
+    b.memory = VK_NULL_HANDLE;
+    b.ptr = nullptr;
+    b.freeRanges.clear();
+}
+
+// First fit. The padding in front of an aligned start stays free.
+bool GpuMemoryAllocator::allocateFrom(int index, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation *alloc)
+{
+    Block &b(m_blocks[index]);
+    for (int i = 0; i < b.freeRanges.count(); ++i) {
+        const Range r = b.freeRanges[i];
+        const VkDeviceSize start = aligned(r.offset, alignment);
+        if (start + size > r.offset + r.size)
+            continue;
+
+        b.freeRanges.remove(i);
+        const VkDeviceSize end = start + size;
+        if (end < r.offset + r.size) {
+            const Range after = { end, r.offset + r.size - end };
+            b.freeRanges.insert(i, after);
+        }
+        if (start > r.offset) {
+            const Range before = { r.offset, start - r.offset };
+            b.freeRanges.insert(i, before);
+        }
+
+        ++b.allocationCount;
+        alloc->memory = b.memory;
+        alloc->offset = start;
+        alloc->size = size;
+        alloc->ptr = b.ptr ? b.ptr + start : nullptr;
+        alloc->block = index;
+        return true;
+    }
+    return false;
+}
+
+bool GpuMemoryAllocator::allocate(const VkMemoryRequirements &memReq, uint32_t memIndex, ResourceKind kind,
+                                  GpuAllocation *alloc)
+{
+    memset(alloc, 0, sizeof(GpuAllocation));
+    if (!(memReq.memoryTypeBits & (1u << memIndex))) {
+        qWarning("Memory type %u is not suitable for the resource", memIndex);
+        return false;
+    }
+
+    // Without a granularity linear and optimal resources can share blocks.
+    if (m_granularity == 1)
+        kind = LinearResource;
+
+    // Flushed ranges must start and end on atom boundaries, so allocations
+    // in non-coherent memory cover whole atoms.
+    VkDeviceSize alignment = qMax<VkDeviceSize>(1, memReq.alignment);
+    VkDeviceSize size = memReq.size;
+    const VkMemoryPropertyFlags flags = m_memProps.memoryTypes[memIndex].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        alignment = qMax(alignment, m_nonCoherentAtomSize);
+        size = aligned(size, m_nonCoherentAtomSize);
+    }
+
+    if (size > BLOCK_SIZE / 2) {
+        const int index = createBlock(size, memIndex, kind, true);
+        return index >= 0 && allocateFrom(index, size, alignment, alloc);
+    }
+
+    for (int i = 0; i < m_blocks.count(); ++i) {
+        const Block &b(m_blocks[i]);
+        if (b.memory && !b.dedicated && b.memIndex == memIndex && b.kind == kind
+                && allocateFrom(i, size, alignment, alloc))
+            return true;
+    }
+
+    const int index = createBlock(BLOCK_SIZE, memIndex, kind, false);
+    return index >= 0 && allocateFrom(index, size, alignment, alloc);
+}
+
+void GpuMemoryAllocator::free(GpuAllocation *alloc)
+{
+    if (!alloc->memory)
+        return;
+
+    Block &b(m_blocks[alloc->block]);
+    Q_ASSERT(b.memory == alloc->memory);
+
+    // Inserts the range in order and merges it with its neighbors.
+    int i = 0;
+    while (i < b.freeRanges.count() && b.freeRanges[i].offset < alloc->offset)
+        ++i;
+    Range r = { alloc->offset, alloc->size };
+    if (i < b.freeRanges.count() && r.offset + r.size == b.freeRanges[i].offset) {
+        r.size += b.freeRanges[i].size;
+        b.freeRanges.remove(i);
+    }
+    if (i > 0 && b.freeRanges[i - 1].offset + b.freeRanges[i - 1].size == r.offset) {
+        b.freeRanges[i - 1].size += r.size;
+    } else {
+        b.freeRanges.insert(i, r);
+    }
+
+    --b.allocationCount;
+    if (!b.allocationCount) {
+        bool keep = !b.dedicated;
+        for (int j = 0; keep && j < m_blocks.count(); ++j) {
+            const Block &other(m_blocks[j]);
+            if (j != alloc->block && other.memory && !other.dedicated && !other.allocationCount
+                    && other.memIndex == b.memIndex && other.kind == b.kind)
+                keep = false;
+        }
+        if (!keep) {
+            releaseBlock(alloc->block);
+            qDebug("released memory block, memory type %u", b.memIndex);
+        }
+    }
+
+    memset(alloc, 0, sizeof(GpuAllocation));
+}
+
+bool GpuMemoryAllocator::isCoherent(const GpuAllocation &alloc) const
+{
+    return m_memProps.memoryTypes[m_blocks[alloc.block].memIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+VkMappedMemoryRange GpuMemoryAllocator::mappedRange(const GpuAllocation &alloc, VkDeviceSize offset,
+                                                    VkDeviceSize size) const
+{
+    VkMappedMemoryRange range;
+    memset(&range, 0, sizeof(range));
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = alloc.memory;
+    // The allocation itself covers whole atoms.
+    range.offset = (alloc.offset + offset) & ~(m_nonCoherentAtomSize - 1);
+    const VkDeviceSize end = qMin(aligned(alloc.offset + offset + size, m_nonCoherentAtomSize),
+                                  alloc.offset + alloc.size);
+    range.size = end - range.offset;
+    return range;
+}
+
+void GpuMemoryAllocator::flush(const GpuAllocation &alloc, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (!size || isCoherent(alloc))
+        return;
+
+    const VkMappedMemoryRange range = mappedRange(alloc, offset, size);
+    VkResult err = m_devFuncs->vkFlushMappedMemoryRanges(m_dev, 1, &range);
+    if (err != VK_SUCCESS)
+        qWarning("Failed to flush mapped memory: %d", err);
+}
+
+GpuMemoryStats GpuMemoryAllocator::stats() const
+{
+    GpuMemoryStats s;
+    VkDeviceSize freeBytes = 0;
+    for (const Block &b : m_blocks) {
+        if (!b.memory)
+            continue;
+        ++s.blockCount;
+        s.allocationCount += b.allocationCount;
+        s.blockBytes += b.size;
+        for (const Range &r : b.freeRanges) {
+            ++s.freeRangeCount;
+            freeBytes += r.size;
+            s.largestFreeRange = qMax(s.largestFreeRange, r.size);
+        }
+    }
+    s.usedBytes = s.blockBytes - freeBytes;
+    if (freeBytes)
+        s.fragmentation = 1.0 - double(s.largestFreeRange) / double(freeBytes);
+    return s;
+}
@@ -0,0 +1,148 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <QVector>
+#include <vulkan/vulkan.h>
+
+class QVulkanDeviceFunctions;
+
+// A range of device memory handed out by GpuMemoryAllocator. All zero when
+// null. ptr points at offset when the memory is host visible.
+struct GpuAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uchar *ptr;
+    int block;
+};
+
+struct GpuMemoryStats
+{
+    int blockCount = 0;
+    int allocationCount = 0;
+    // Allocated from the device, and handed out of that.
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    int freeRangeCount = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 0 when all free space in the blocks is one range, towards 1 the more
+    // it is split up.
+    double fragmentation = 0;
+};
+
+// Sub-allocates resources from a few large blocks of device memory, one
+// set of blocks per memory type, instead of one vkAllocateMemory per
+// resource. Blocks of host visible memory stay mapped. Buffers and linear
+// images go into different blocks than optimal images when the device has
+// a bufferImageGranularity, so neighbors never share a page. Allocations
+// larger than half a block get a block of their own, which is returned to
+// the device when freed, as are empty blocks beyond one per memory type.
+class GpuMemoryAllocator
+{
+public:
+    enum ResourceKind {
+        LinearResource,     // buffers and linearly tiled images
+        OptimalResource     // optimally tiled images
+    };
+
+    static const VkDeviceSize BLOCK_SIZE = 16 * 1024 * 1024;
+
+    void create(QVulkanDeviceFunctions *devFuncs, VkDevice dev, const VkPhysicalDeviceMemoryProperties &memProps,
+                const VkPhysicalDeviceLimits &limits);
+    void destroy();
+
+    bool allocate(const VkMemoryRequirements &memReq, uint32_t memIndex, ResourceKind kind, GpuAllocation *alloc);
+    // Resets alloc to null.
+    void free(GpuAllocation *alloc);
+
+    // Range of the allocation's memory to flush after writing size bytes at
+    // offset within it, expanded to the non-coherent atom size. Flushing is
+    // only needed when the memory type is not host coherent.
+    VkMappedMemoryRange mappedRange(const GpuAllocation &alloc, VkDeviceSize offset, VkDeviceSize size) const;
+    bool isCoherent(const GpuAllocation &alloc) const;
+    void flush(const GpuAllocation &alloc, VkDeviceSize offset, VkDeviceSize size);
+
+    GpuMemoryStats stats() const;
+
+private:
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+    struct Block {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t memIndex;
+        ResourceKind kind;
+        bool dedicated;
+        uchar *ptr;
+        int allocationCount;
+        QVector<Range> freeRanges; // sorted by offset
+    };
+
+    int createBlock(VkDeviceSize size, uint32_t memIndex, ResourceKind kind, bool dedicated);
+    void releaseBlock(int index);
+    bool allocateFrom(int index, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation *alloc);
+
+    QVulkanDeviceFunctions *m_devFuncs = nullptr;
+    VkDevice m_dev = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_memProps;
+    VkDeviceSize m_granularity = 1;
+    VkDeviceSize m_nonCoherentAtomSize = 1;
+    // Released blocks leave a null entry, allocations refer to blocks by
+    // index.
+    QVector<Block> m_blocks;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "incrementalpresent.h"
+#include <QHash>
+#include <QMutex>
+#include <QVarLengthArray>
+
+#include <QtGui/private/qvulkanwindow_p.h>
+
+// What a hooked swapchain's window presented with before, and the damage
+// for its next present.
+struct HookedSwapChain {
+    PFN_vkQueuePresentKHR queuePresent;
+    QVector<VkRectLayerKHR> damage;
+};
+
+// Presents may come from any thread, windows may live on different ones.
+static QMutex s_lock;
+static QHash<VkSwapchainKHR, HookedSwapChain> s_swapChains;
+
+static VKAPI_ATTR VkResult VKAPI_CALL queuePresentWithDamage(VkQueue queue, const VkPresentInfoKHR *presentInfo)
+{
+    // The damage is taken for this present only, whatever happens to it.
+    // A swapchain without damage gets no rects, which stands for the whole
+    // image.
+    PFN_vkQueuePresentKHR queuePresent = nullptr;
+    QVarLengthArray<QVector<VkRectLayerKHR>, 1> damage(int(presentInfo->swapchainCount));
+    bool hasDamage = false;
+    {
+        QMutexLocker locker(&s_lock);
+        for (uint32_t i = 0; i < presentInfo->swapchainCount; ++i) {
+            auto it = s_swapChains.find(presentInfo->pSwapchains[i]);
+            if (it == s_swapChains.end())
+                continue;
+            if (!queuePresent)
+                queuePresent = it->queuePresent;
+            damage[int(i)].swap(it->damage);
+            hasDamage |= !damage[int(i)].isEmpty();
+        }
+    }
+
+    // Only hooked windows present through here, with their own swapchain.
+    if (!queuePresent) {
+        qWarning("Present for a swapchain that is not hooked");
+        return VK_ERROR_OUT_OF_DATE_KHR;
+    }
+
+    if (!hasDamage)
+        return queuePresent(queue, presentInfo);
+
+    QVarLengthArray<VkPresentRegionKHR, 1> regions(int(presentInfo->swapchainCount));
+    for (int i = 0; i < regions.count(); ++i) {
+        regions[i].rectangleCount = uint32_t(damage[i].count());
+        regions[i].pRectangles = damage[i].isEmpty() ? nullptr : damage[i].constData();
+    }
+
+    VkPresentRegionsKHR presentRegions;
+    memset(&presentRegions, 0, sizeof(presentRegions));
+    presentRegions.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+    presentRegions.pNext = presentInfo->pNext;
+    presentRegions.swapchainCount = presentInfo->swapchainCount;
+    presentRegions.pRegions = regions.constData();
+
+    VkPresentInfoKHR info = *presentInfo;
+    info.pNext = &presentRegions;
+    return queuePresent(queue, &info);
+}
+
+// QVulkanWindow has no getter for the extensions it was given.
+void requestIncrementalPresent(QVulkanWindow *window, bool enable)
+{
+    QVulkanWindowPrivate *d = static_cast<QVulkanWindowPrivate *>(QWindowPrivate::get(window));
+    QByteArrayList extensions = d->requestedDevExtensions;
+    extensions.removeAll(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+    if (enable)
+        extensions.append(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+    window->setDeviceExtensions(extensions);
+}
+
+static VkSwapchainKHR swapChainOf(QVulkanWindow *window)
+{
+    return static_cast<QVulkanWindowPrivate *>(QWindowPrivate::get(window))->swapChain;
+}
+
+bool hookIncrementalPresent(QVulkanWindow *window)
+{
+    if (!window->supportedDeviceExtensions().contains(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME))
+        return false;
+
+    // Resolved the same way QVulkanWindow does it, rather than taken from
+    // the window, which may already point here.
+    HookedSwapChain hooked;
+    hooked.queuePresent = reinterpret_cast<PFN_vkQueuePresentKHR>(
+                window->vulkanInstance()->functions()->vkGetDeviceProcAddr(window->device(), "vkQueuePresentKHR"));
+    if (!hooked.queuePresent)
+        return false;
+
+    QVulkanWindowPrivate *d = static_cast<QVulkanWindowPrivate *>(QWindowPrivate::get(window));
+    {
+        QMutexLocker locker(&s_lock);
+        s_swapChains.insert(d->swapChain, hooked);
+    }
+    d->vkQueuePresentKHR = queuePresentWithDamage;
+    return true;
+}
+
+void unhookIncrementalPresent(QVulkanWindow *window)
+{
+    QMutexLocker locker(&s_lock);
+    s_swapChains.remove(swapChainOf(window));
+}
+
+void setPresentDamage(QVulkanWindow *window, const QVector<QRect> &rects)
+{
+    QVector<VkRectLayerKHR> damage;
+    damage.reserve(rects.count());
+    for (const QRect &r : rects) {
+        VkRectLayerKHR rect;
+        rect.offset.x = r.x();
+        rect.offset.y = r.y();
+        rect.extent.width = uint32_t(r.width());
+        rect.extent.height = uint32_t(r.height());
+        rect.layer = 0;
+        damage.append(rect);
+    }
+
+    QMutexLocker locker(&s_lock);
+    auto it = s_swapChains.find(swapChainOf(window));
+    if (it != s_swapChains.end())
+        it->damage.swap(damage);
+}
@@ -0,0 +1,81 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef INCREMENTALPRESENT_H
+#define INCREMENTALPRESENT_H
+
+#include <QVulkanWindow>
+#include <QVector>
+#include <QRect>
+
+// VK_KHR_incremental_present tells the presentation engine which parts of
+// a swapchain image changed since the previous present, so a compositor can
+// skip recomposing the rest. QVulkanWindow presents by itself and has no way
+// to chain the regions into the present, so its present call is routed
+// through here instead. Each hooked swapchain keeps its own damage and the
+// present function its window used before.
+
+// Adds the extension to, or removes it from, the device extensions the
+// window asks for, leaving the others alone. Has to be called before the
+// window is shown.
+void requestIncrementalPresent(QVulkanWindow *window, bool enable);
+
+// Call after the swapchain is created, and again after it is
+// recreated. Returns false when the device does not support the extension.
+bool hookIncrementalPresent(QVulkanWindow *window);
+
+// Forgets the window's current swapchain. Call before it is released.
+void unhookIncrementalPresent(QVulkanWindow *window);
+
+// The damage for the next present of the window, in swapchain image pixels.
+// An empty list means the whole image changed.
+void setPresentDamage(QVulkanWindow *window, const QVector<QRect> &rects);
+
+#endif
@@ -51,7 +51,9 @@
 #include <QGuiApplication>
 #include <QVulkanInstance>
 #include <QLoggingCategory>
+#include <QCommandLineParser>
 #include "vulkanwindow.h"
+#include "quickscenemanager.h"
 
 Q_LOGGING_CATEGORY(lcVk, "qt.vulkan")
 
@@ -61,6 +63,76 @@ int main(int argc, char *argv[])
 
     QLoggingCategory::setFilterRules(QStringLiteral("qt.vulkan=true"));
 
+    QCommandLineParser cmdLineParser;
+    cmdLineParser.addHelpOption();
+    QCommandLineOption threadedOption(QStringLiteral("threaded"),
+                                      QStringLiteral("Render the Qt Quick scene on a dedicated thread"));
+    cmdLineParser.addOption(threadedOption);
+    QCommandLineOption tiledOption(QStringLiteral("tiled"),
+                                   QStringLiteral("Rasterize the Qt Quick scene in parallel bands"));
+    cmdLineParser.addOption(tiledOption);
+    QCommandLineOption uploadOption(QStringLiteral("upload"),
+                                    QStringLiteral("Texture upload path: auto, linear, staging, shared or compressed"),
+                                    QStringLiteral("mode"), QStringLiteral("auto"));
+    cmdLineParser.addOption(uploadOption);
+    QCommandLineOption formatOption(QStringLiteral("format"),
+                                    QStringLiteral("Pixel format of the Qt Quick scene: argb32, rgb32, rgb565, argb4444 or gray8"),
+                                    QStringLiteral("format"), QStringLiteral("argb32"));
+    cmdLineParser.addOption(formatOption);
+    QCommandLineOption opaqueOption(QStringLiteral("opaque"),
+                                    QStringLiteral("Draw the Qt Quick scene without blending"));
+    cmdLineParser.addOption(opaqueOption);
+    QCommandLineOption mipmapsOption(QStringLiteral("mipmaps"),
+                                     QStringLiteral("Generate mipmaps for the Qt Quick texture"));
+    cmdLineParser.addOption(mipmapsOption);
+    QCommandLineOption anisotropyOption(QStringLiteral("anisotropy"),
+                                        QStringLiteral("Maximum degree of anisotropic filtering, 1 to disable"),
+                                        QStringLiteral("degree"), QStringLiteral("1"));
+    cmdLineParser.addOption(anisotropyOption);
+    QCommandLineOption lodOption(QStringLiteral("lod"),
+                                 QStringLiteral("Render the Qt Quick scene at a lower resolution when it is small on screen"));
+    cmdLineParser.addOption(lodOption);
+    QCommandLineOption framesInFlightOption(QStringLiteral("frames-in-flight"),
+                                            QStringLiteral("Maximum number of frames queued up on the GPU, 0 for the default"),
+                                            QStringLiteral("count"), QStringLiteral("0"));
+    cmdLineParser.addOption(framesInFlightOption);
+    QCommandLineOption lateLatchOption(QStringLiteral("late-latch"),
+                                       QStringLiteral("Deliver input and render the Qt Quick scene as late in the frame as possible"));
+    cmdLineParser.addOption(lateLatchOption);
+    QCommandLineOption onDemandOption(QStringLiteral("on-demand"),
+                                      QStringLiteral("Only render when the Qt Quick scene or input asks for it"));
+    cmdLineParser.addOption(onDemandOption);
+    QCommandLineOption keepAliveOption(QStringLiteral("keep-alive"),
+                                       QStringLiteral("In on-demand mode, render at least every <msecs> milliseconds"),
+                                       QStringLiteral("msecs"), QStringLiteral("0"));
+    cmdLineParser.addOption(keepAliveOption);
+    QCommandLineOption damageOption(QStringLiteral("damage-tracking"),
+                                    QStringLiteral("Only redraw and present the parts of the window that changed"));
+    cmdLineParser.addOption(damageOption);
+    QCommandLineOption quickSizeOption(QStringLiteral("quick-size"),
+                                       QStringLiteral("Size of the Qt Quick scene: <width>x<height>, or window to follow the window size"),
+                                       QStringLiteral("size"), QStringLiteral("512x512"));
+    cmdLineParser.addOption(quickSizeOption);
+    QCommandLineOption pipelineCacheOption(QStringLiteral("pipeline-cache-dir"),
+                                           QStringLiteral("Directory for the on-disk pipeline cache, empty to disable it"),
+                                           QStringLiteral("dir"));
+    cmdLineParser.addOption(pipelineCacheOption);
+    QCommandLineOption statsOption(QStringLiteral("stats"),
+                                   QStringLiteral("Log per-frame timings and counters"));
+    cmdLineParser.addOption(statsOption);
+    QCommandLineOption traceOption(QStringLiteral("trace"),
+                                   QStringLiteral("Write a Chrome trace of the frame timings to <file> on exit"),
+                                   QStringLiteral("file"));
+    cmdLineParser.addOption(traceOption);
+    QCommandLineOption panelsOption(QStringLiteral("panels"),
+                                    QStringLiteral("Show <count> additional Qt Quick panels, drawn from a shared atlas"),
+                                    QStringLiteral("count"), QStringLiteral("0"));
+    cmdLineParser.addOption(panelsOption);
+    cmdLineParser.process(app);
+
+    if (cmdLineParser.isSet(statsOption))
+        QLoggingCategory::setFilterRules(QStringLiteral("qt.vulkan=true\nswquick.stats.debug=true"));
+
     QVulkanInstance inst;
 
 #ifndef Q_OS_ANDROID
@@ -81,6 +153,60 @@ int main(int argc, char *argv[])
 
     VulkanWindowWithSwQuick w;
     w.setVulkanInstance(&inst);
+    w.setThreadedQuickRendering(cmdLineParser.isSet(threadedOption));
+    w.setTiledQuickRendering(cmdLineParser.isSet(tiledOption));
+    const QString upload = cmdLineParser.value(uploadOption);
+    if (upload == QStringLiteral("linear"))
+        w.setTextureUpload(VulkanWindowWithSwQuick::LinearTextureUpload);
+    else if (upload == QStringLiteral("staging"))
+        w.setTextureUpload(VulkanWindowWithSwQuick::StagingTextureUpload);
+    else if (upload == QStringLiteral("shared"))
+        w.setTextureUpload(VulkanWindowWithSwQuick::SharedTextureUpload);
+    else if (upload == QStringLiteral("compressed"))
+        w.setTextureUpload(VulkanWindowWithSwQuick::CompressedTextureUpload);
+    const QString format = cmdLineParser.value(formatOption);
+    if (format == QStringLiteral("rgb32"))
+        w.setQuickImageFormat(QImage::Format_RGB32);
+    else if (format == QStringLiteral("rgb565"))
+        w.setQuickImageFormat(QImage::Format_RGB16);
+    else if (format == QStringLiteral("argb4444"))
+        w.setQuickImageFormat(QImage::Format_ARGB4444_Premultiplied);
+    else if (format == QStringLiteral("gray8"))
+        w.setQuickImageFormat(QImage::Format_Grayscale8);
+    else if (format != QStringLiteral("argb32"))
+        qWarning("Unknown Qt Quick image format %s", qPrintable(format));
+    w.setOpaqueQuick(cmdLineParser.isSet(opaqueOption));
+    w.setQuickMipmaps(cmdLineParser.isSet(mipmapsOption));
+    w.setQuickMaxAnisotropy(cmdLineParser.value(anisotropyOption).toFloat());
+    w.setQuickLodRendering(cmdLineParser.isSet(lodOption));
+    w.setMaxFramesInFlight(cmdLineParser.value(framesInFlightOption).toInt());
+    w.setLateLatching(cmdLineParser.isSet(lateLatchOption));
+    w.setOnDemandRendering(cmdLineParser.isSet(onDemandOption));
+    w.setKeepAliveInterval(cmdLineParser.value(keepAliveOption).toInt());
+    w.setDamageTracking(cmdLineParser.isSet(damageOption));
+    if (cmdLineParser.isSet(traceOption))
+        w.setTraceFile(cmdLineParser.value(traceOption));
+    if (cmdLineParser.isSet(pipelineCacheOption))
+        w.setPipelineCacheDirectory(cmdLineParser.value(pipelineCacheOption));
+    const QString quickSize = cmdLineParser.value(quickSizeOption);
+    if (quickSize == QStringLiteral("window")) {
+        w.setQuickSize(QSize());
+    } else {
+        const QStringList dims = quickSize.split(QLatin1Char('x'));
+        if (dims.count() == 2 && dims[0].toInt() > 0 && dims[1].toInt() > 0)
+            w.setQuickSize(QSize(dims[0].toInt(), dims[1].toInt()));
+        else
+            qWarning("Invalid Qt Quick scene size %s", qPrintable(quickSize));
+    }
+
+    // A row of small panels below the main quad.
+    const int panelCount = cmdLineParser.value(panelsOption).toInt();
+    for (int i = 0; i < panelCount; ++i) {
+        QMatrix4x4 m;
+        m.translate(-1.5f + 3.0f * (i + 0.5f) / panelCount, -1.4f, 0.5f);
+        m.scale(qMin(0.3f, 1.4f / panelCount));
+        w.sceneManager()->addScene(QUrl(QStringLiteral("qrc:/rotatingsquare.qml")), QSize(128, 128), m);
+    }
 
     w.resize(1024, 768);
     w.show();
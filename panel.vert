@@ -0,0 +1,18 @@
+#version 440
+
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec2 texcoord;
+
+// Per instance: the panel's full transform and its rect in the atlas.
+layout(location = 2) in mat4 mvp;
+layout(location = 6) in vec4 uvRect;
+
+layout(location = 0) out vec2 v_texcoord;
+
+out gl_PerVertex { vec4 gl_Position; };
+
+void main()
+{
+    v_texcoord = uvRect.xy + texcoord * uvRect.zw;
+    gl_Position = mvp * position;
+}
@@ -0,0 +1,113 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "quadhit.h"
+#include <QVector3D>
+#include <QVector4D>
+
+// Unprojects the position onto the near and far planes, Vulkan's 0 and 1
+// depth, straight into model space, and intersects the line between the two
+// with z = 0 there. Since the model transform is affine, the line parameter
+// is the same in every space, which makes it usable as the distance.
+bool hitTestQuad(const QMatrix4x4 &mvp, const QPointF &pos, const QSize &viewport,
+                 QPointF *uv, float *distance)
+{
+    if (viewport.isEmpty())
+        return false;
+
+    bool invertible = false;
+    const QMatrix4x4 inv = mvp.inverted(&invertible);
+    if (!invertible)
+        return false;
+
+    const float x = 2.0f * float(pos.x()) / viewport.width() - 1.0f;
+    const float y = 2.0f * float(pos.y()) / viewport.height() - 1.0f;
+    const QVector4D nearPoint = inv * QVector4D(x, y, 0, 1);
+    const QVector4D farPoint = inv * QVector4D(x, y, 1, 1);
+    if (nearPoint.w() == 0 || farPoint.w() == 0)
+        return false;
+
+    const QVector3D a = nearPoint.toVector3DAffine();
+    const QVector3D b = farPoint.toVector3DAffine();
+    const float dz = b.z() - a.z();
+    if (dz == 0)
+        return false; // parallel to the quad
+
+    const float t = -a.z() / dz;
+    if (t < 0 || t > 1)
+        return false;
+
+    const QVector3D hit = a + t * (b - a);
+    *uv = QPointF((hit.x() + 1) / 2, (1 - hit.y()) / 2);
+    *distance = t;
+    return true;
+}
+
+QRect projectQuadRect(const QMatrix4x4 &mvp, const QRectF &uvRect, const QSize &viewport)
+{
+    const QRect viewportRect(QPoint(0, 0), viewport);
+    const QPointF corners[4] = { uvRect.topLeft(), uvRect.topRight(), uvRect.bottomLeft(), uvRect.bottomRight() };
+    qreal left = viewport.width(), top = viewport.height(), right = 0, bottom = 0;
+    for (const QPointF &uv : corners) {
+        const QVector4D clip = mvp * QVector4D(2 * uv.x() - 1, 1 - 2 * uv.y(), 0, 1);
+        if (clip.w() <= 0)
+            return viewportRect;
+        const qreal x = (clip.x() / clip.w() + 1) * 0.5 * viewport.width();
+        const qreal y = (clip.y() / clip.w() + 1) * 0.5 * viewport.height();
+        left = qMin(left, x);
+        top = qMin(top, y);
+        right = qMax(right, x);
+        bottom = qMax(bottom, y);
+    }
+    if (right <= left || bottom <= top)
+        return QRect();
+
+    return QRectF(QPointF(left, top), QPointF(right, bottom)).toAlignedRect() & viewportRect;
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QUADHIT_H
+#define QUADHIT_H
+
+#include <QMatrix4x4>
+#include <QPointF>
+#include <QRect>
+#include <QSize>
+
+// Intersects the ray through a position in the swapchain image (in pixels)
+// with the plane of a unit quad, which spans -1..1 in the xy plane of the
+// model space mvp transforms from. uv is the hit in texture coordinates, 0..1
+// inside the quad, and outside of that range when the quad is missed but its
+// plane is not. distance orders hits on different quads along the same ray,
+// smaller is closer. Returns false when the plane is not hit in front of the
+// camera.
+bool hitTestQuad(const QMatrix4x4 &mvp, const QPointF &pos, const QSize &viewport,
+                 QPointF *uv, float *distance);
+
+// The other way around: the bounding rect, in swapchain image pixels, of
+// the part of the quad covered by uvRect. Returns the whole viewport when any
+// of it is behind the camera, and an empty rect when it is off screen.
+QRect projectQuadRect(const QMatrix4x4 &mvp, const QRectF &uvRect, const QSize &viewport);
+
+inline bool isInsideQuad(const QPointF &uv)
+{
+    return uv.x() >= 0 && uv.x() <= 1 && uv.y() >= 0 && uv.y() <= 1;
+}
+
+#endif
@@ -0,0 +1,262 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "quickrenderthread.h"
+#include "rectcopy.h"
+#include "frameprofiler.h"
+#include <QCoreApplication>
+#include <QQuickRenderControl>
+#include <QQuickWindow>
+
+#include <QtQuick/private/qquickwindow_p.h>
+#include <QtQuick/private/qsgsoftwarerenderer_p.h>
+
+static void copyRegion(QImage *dst, const QImage &src, const QRegion &region)
+{
+    // The destination is about to be painted into, keep it in the cache.
+    const QRegion clipped = region & QRect(QPoint(0, 0), dst->size());
+    copyDirtyRects(dst->bits(), dst->bytesPerLine(), src, coalesceDirtyRects(clipped, dst->depth() / 8),
+                   ScalarRectCopyKernel);
+}
+
+QuickRenderThread::QuickRenderThread(QQuickRenderControl *renderControl, QQuickWindow *quickWindow,
+                                     QImage::Format format, FrameProfiler *profiler)
+    : m_renderControl(renderControl),
+      m_quickWindow(quickWindow),
+      m_format(format),
+      m_profiler(profiler)
+{
+}
+
+void QuickRenderThread::stop()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_quit = true;
+        m_cond.wakeAll();
+    }
+    wait();
+}
+
+bool QuickRenderThread::isBusy() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_busy;
+}
+
+// Called on the GUI thread after polishItems(). Returns false without doing
+// anything when the previous frame is still being rendered, otherwise blocks
+// until the scene graph has been synced.
+bool QuickRenderThread::requestFrame(const QSize &pixelSize, qreal dpr)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_busy)
+        return false;
+
+    m_requestedSize = pixelSize;
+    m_requestedDpr = dpr;
+    m_busy = true;
+    m_syncRequested = true;
+    m_cond.wakeAll();
+
+    while (m_syncRequested)
+        m_cond.wait(&m_mutex);
+
+    return true;
+}
+
+// Called on the GUI thread. Returns the newest completed image, or null when
+// nothing was rendered since the last call. The returned image stays valid and
+// untouched until the next call. dirtyRegion receives the union of all regions
+// changed since the previously taken image.
+const QImage *QuickRenderThread::takeLatestImage(QRegion *dirtyRegion)
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_hasNewImage)
+        return nullptr;
+
+    m_hasNewImage = false;
+    m_held = m_latest;
+    if (dirtyRegion)
+        *dirtyRegion = m_pendingDirty;
+    m_pendingDirty = QRegion();
+
+    return &m_images[m_held];
+}
+
+int QuickRenderThread::targetSlot() const
+{
+    for (int i = 0; i < IMAGE_COUNT; ++i) {
+        if (i != m_latest && i != m_held)
+            return i;
+    }
+    Q_UNREACHABLE();
+    return -1;
+}
+
+// The software renderer only repaints what changed in the scene, so the
+// target must first be brought up to date with whatever the other images
+// received since this one was last rendered to.
+void QuickRenderThread::prepareSlot(int slot, const QSize &pixelSize, qreal dpr, int latest)
+{
+    QImage &img(m_images[slot]);
+    if (img.size() != pixelSize || img.devicePixelRatio() != dpr) {
+        img = QImage(pixelSize, m_format);
+        img.setDevicePixelRatio(dpr);
+        m_stale[slot] = QRect(QPoint(0, 0), pixelSize);
+        // The renderer only goes by the logical size, which may not have
+        // changed, so it has to be told to paint everything.
+        m_imageFresh = true;
+    }
+
+    if (latest >= 0 && m_images[latest].size() == pixelSize)
+        copyRegion(&img, m_images[latest], m_stale[slot]);
+
+    m_stale[slot] = QRegion();
+}
+
+void QuickRenderThread::render(int slot, QRegion *dirtyRegion)
+{
+    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_quickWindow);
+    QSGSoftwareRenderer *r = static_cast<QSGSoftwareRenderer *>(wd->renderer);
+    r->setCurrentPaintDevice(&m_images[slot]);
+    if (m_imageFresh)
+        r->markDirty();
+
+    m_renderControl->render();
+
+    m_imageFresh = false;
+    *dirtyRegion = toImagePixels(r->flushRegion(), m_images[slot]);
+}
+
+// Called on the render thread with the mutex held. The renderer only exists
+// after the first sync, which is always treated as a change.
+void QuickRenderThread::watchSceneGraph()
+{
+    QSGRenderer *r = QQuickWindowPrivate::get(m_quickWindow)->renderer;
+    if (r && r != m_watchedRenderer) {
+        m_watchedRenderer = r;
+        connect(r, &QSGAbstractRenderer::sceneGraphChanged, this, &QuickRenderThread::onSceneGraphChanged,
+                Qt::DirectConnection);
+        m_sceneGraphChanged = true;
+    }
+}
+
+// Emitted during sync, so on the render thread with the mutex held.
+void QuickRenderThread::onSceneGraphChanged()
+{
+    m_sceneGraphChanged = true;
+}
+
+void QuickRenderThread::run()
+{
+    QMutexLocker lock(&m_mutex);
+
+    for (;;) {
+        while (!m_syncRequested && !m_quit)
+            m_cond.wait(&m_mutex);
+
+        if (m_quit)
+            break;
+
+        // The GUI thread is blocked in requestFrame() while this runs.
+        {
+            ScopedStageTimer t(m_profiler, FrameProfiler::Sync);
+            m_renderControl->sync();
+        }
+        watchSceneGraph();
+        m_syncRequested = false;
+        m_cond.wakeAll();
+
+        const int slot = targetSlot();
+        const int latest = m_latest;
+        const QSize pixelSize = m_requestedSize;
+        const qreal dpr = m_requestedDpr;
+
+        // Nothing to render when the sync did not touch the scene graph and
+        // the newest image has the requested size already.
+        const bool upToDate = latest >= 0 && m_images[latest].size() == pixelSize
+                && m_images[latest].devicePixelRatio() == dpr;
+        if (!m_sceneGraphChanged && upToDate) {
+            m_profiler->addSkippedRender();
+            m_busy = false;
+            continue;
+        }
+        m_sceneGraphChanged = false;
+
+        // Only the GUI thread's m_held may change while unlocked, and that
+        // is never the target slot.
+        lock.unlock();
+        QRegion dirtyRegion;
+        {
+            ScopedStageTimer t(m_profiler, FrameProfiler::Render);
+            prepareSlot(slot, pixelSize, dpr, latest);
+            render(slot, &dirtyRegion);
+        }
+        lock.relock();
+
+        if (dirtyRegion.isEmpty())
+            m_profiler->addWastedRender();
+
+        for (int i = 0; i < IMAGE_COUNT; ++i) {
+            if (i != slot)
+                m_stale[i] += dirtyRegion;
+        }
+        m_latest = slot;
+        m_pendingDirty += dirtyRegion;
+        m_hasNewImage = true;
+        m_busy = false;
+
+        emit frameReady();
+    }
+
+    m_renderControl->invalidate();
+    m_renderControl->prepareThread(QCoreApplication::instance()->thread());
+}
@@ -0,0 +1,124 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QUICKRENDERTHREAD_H
+#define QUICKRENDERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include <QRegion>
+
+class QQuickRenderControl;
+class QQuickWindow;
+class FrameProfiler;
+class QSGRenderer;
+
+// Renders the software scene graph into a small ring of QImages on a
+// dedicated thread. Polishing stays on the GUI thread, syncing happens on
+// this thread while the GUI thread is blocked in requestFrame(), the actual
+// raster pass then runs without blocking anyone.
+class QuickRenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    static const int IMAGE_COUNT = 3;
+
+    QuickRenderThread(QQuickRenderControl *renderControl, QQuickWindow *quickWindow,
+                      QImage::Format format, FrameProfiler *profiler);
+
+    void stop();
+
+    bool isBusy() const;
+    bool requestFrame(const QSize &pixelSize, qreal dpr);
+    const QImage *takeLatestImage(QRegion *dirtyRegion);
+
+signals:
+    void frameReady();
+
+protected:
+    void run() override;
+
+private:
+    int targetSlot() const;
+    void prepareSlot(int slot, const QSize &pixelSize, qreal dpr, int latest);
+    void render(int slot, QRegion *dirtyRegion);
+    void watchSceneGraph();
+    void onSceneGraphChanged();
+
+    QQuickRenderControl *m_renderControl;
+    QQuickWindow *m_quickWindow;
+    QImage::Format m_format;
+    FrameProfiler *m_profiler;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_cond;
+    bool m_syncRequested = false;
+    bool m_busy = false;
+    bool m_quit = false;
+    QSize m_requestedSize;
+    qreal m_requestedDpr = 1;
+
+    // m_latest is the newest completed image, m_held is the one the GUI
+    // thread took last and may still be reading. Neither is ever rendered to.
+    QImage m_images[IMAGE_COUNT];
+    QRegion m_stale[IMAGE_COUNT];
+    bool m_imageFresh = false;
+    int m_latest = -1;
+    int m_held = -1;
+    bool m_hasNewImage = false;
+    QRegion m_pendingDirty;
+    QSGRenderer *m_watchedRenderer = nullptr;
+    bool m_sceneGraphChanged = false;
+};
+
+#endif
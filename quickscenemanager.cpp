@@ -0,0 +1,295 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "quickscenemanager.h"
+#include "frameprofiler.h"
+#include "rectcopy.h"
+#include <QQuickRenderControl>
+#include <QQuickWindow>
+#include <QQuickItem>
+#include <QQmlEngine>
+#include <QQmlComponent>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <QtQuick/private/qquickwindow_p.h>
+#include <QtQuick/private/qsgsoftwarerenderer_p.h>
+
+class SceneRenderControl : public QQuickRenderControl
+{
+public:
+    SceneRenderControl(QWindow *w) : m_window(w) { }
+    QWindow *renderWindow(QPoint *offset) override;
+
+private:
+    QWindow *m_window;
+};
+
+QWindow *SceneRenderControl::renderWindow(QPoint *offset)
+{
+    if (offset)
+        *offset = QPoint(0, 0);
+    return m_window;
+}
+
+QuickScene::QuickScene(QQmlEngine *engine, QWindow *renderWindow, const QUrl &url, const QSize &size)
+    : m_size(size)
+{
+    m_renderControl = new SceneRenderControl(renderWindow);
+
+    m_quickWindow = new QQuickWindow(m_renderControl);
+    m_quickWindow->setColor(Qt::transparent);
+    m_quickWindow->setGeometry(0, 0, size.width(), size.height());
+
+    createImage();
+
+    connect(m_renderControl, &QQuickRenderControl::renderRequested, this, &QuickScene::onSceneChanged);
+    connect(m_renderControl, &QQuickRenderControl::sceneChanged, this, &QuickScene::onSceneChanged);
+
+    m_qmlComponent = new QQmlComponent(engine, url);
+    if (m_qmlComponent->isLoading())
+        connect(m_qmlComponent, &QQmlComponent::statusChanged, this, &QuickScene::onStatusChanged);
+    else
+        onStatusChanged();
+}
+
+QuickScene::~QuickScene()
+{
+    delete m_renderControl;
+    delete m_qmlComponent;
+    delete m_quickWindow;
+}
+
+// Panels are small and do not bother with high DPI, the device pixel ratio
+// is only ever lowered by the render scale.
+void QuickScene::createImage()
+{
+    const qreal scale = m_renderScale.scale();
+    m_image = QImage(QSize(qCeil(m_size.width() * scale), qCeil(m_size.height() * scale)),
+                     QImage::Format_ARGB32_Premultiplied);
+    m_image.setDevicePixelRatio(scale);
+    m_image.fill(Qt::transparent);
+    m_imageFresh = true;
+}
+
+void QuickScene::updateFootprint(const QSizeF &pixelSize)
+{
+    if (pixelSize.isEmpty())
+        return;
+
+    const qreal needed = qMax(pixelSize.width() / m_size.width(), pixelSize.height() / m_size.height());
+    if (m_renderScale.update(needed)) {
+        createImage();
+        onSceneChanged();
+    }
+}
+
+void QuickScene::onStatusChanged()
+{
+    if (m_qmlComponent->isLoading())
+        return;
+
+    disconnect(m_qmlComponent, &QQmlComponent::statusChanged, this, &QuickScene::onStatusChanged);
+
+    QObject *rootObject = m_qmlComponent->isError() ? nullptr : m_qmlComponent->create();
+    if (m_qmlComponent->isError()) {
+        const QList<QQmlError> errorList = m_qmlComponent->errors();
+        for (const QQmlError &error : errorList)
+            qWarning() << error.url() << error.line() << error;
+        return;
+    }
+
+    m_rootItem = qobject_cast<QQuickItem *>(rootObject);
+    if (!m_rootItem) {
+        qWarning("QuickScene: Not a QQuickItem");
+        delete rootObject;
+        return;
+    }
+
+    m_rootItem->setParentItem(m_quickWindow->contentItem());
+    m_rootItem->setWidth(m_size.width());
+    m_rootItem->setHeight(m_size.height());
+
+    onSceneChanged();
+}
+
+void QuickScene::onSceneChanged()
+{
+    m_changed = true;
+    emit changed();
+}
+
+void QuickScene::polishAndSync()
+{
+    m_renderControl->polishItems();
+    m_renderControl->sync();
+}
+
+// Returns the changed area of the image. Only touches this scene's renderer
+// and image, the scene graph is left alone until the next sync.
+QRegion QuickScene::renderSynced()
+{
+    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_quickWindow);
+    QSGSoftwareRenderer *r = static_cast<QSGSoftwareRenderer *>(wd->renderer);
+    r->setCurrentPaintDevice(&m_image);
+    // The scene graph may be unchanged, but the new image is blank.
+    if (m_imageFresh)
+        r->markDirty();
+
+    m_renderControl->render();
+
+    m_imageFresh = false;
+    m_changed = false;
+    m_rendered = true;
+    return toImagePixels(r->flushRegion(), m_image);
+}
+
+QuickSceneManager::QuickSceneManager(QWindow *renderWindow, const QSize &atlasSize, FrameProfiler *profiler)
+    : m_renderWindow(renderWindow),
+      m_profiler(profiler),
+      m_qmlEngine(new QQmlEngine),
+      m_atlas(atlasSize)
+{
+}
+
+QuickSceneManager::~QuickSceneManager()
+{
+    qDeleteAll(m_scenes);
+    delete m_qmlEngine;
+}
+
+// Returns null when the panel does not fit into the atlas anymore.
+QuickScene *QuickSceneManager::addScene(const QUrl &url, const QSize &size, const QMatrix4x4 &transform)
+{
+    if (m_scenes.count() >= MAX_SCENES) {
+        qWarning("Too many Quick scenes, at most %d are supported", MAX_SCENES);
+        return nullptr;
+    }
+
+    const QRect atlasRect = m_atlas.allocate(size);
+    if (atlasRect.isNull()) {
+        qWarning("No room for a %dx%d Quick scene in the atlas", size.width(), size.height());
+        return nullptr;
+    }
+
+    QuickScene *scene = new QuickScene(m_qmlEngine, m_renderWindow, url, size);
+    scene->setTransform(transform);
+    scene->setAtlasRect(atlasRect);
+    connect(scene, &QuickScene::changed, this, &QuickSceneManager::changed);
+    m_scenes.append(scene);
+
+    emit changed();
+    return scene;
+}
+
+void QuickSceneManager::removeScene(QuickScene *scene)
+{
+    if (!m_scenes.removeOne(scene))
+        return;
+
+    m_atlas.release(scene->atlasRect());
+    delete scene;
+
+    emit changed();
+}
+
+bool QuickSceneManager::hasChanges() const
+{
+    for (QuickScene *scene : m_scenes) {
+        if (scene->isRunning() && scene->hasChanged())
+            return true;
+    }
+    return false;
+}
+
+// Polishes, syncs and renders every scene that changed since the last call.
+// Polish and sync touch the QML objects and so stay on the GUI thread, one
+// scene after the other. The raster pass, which is where the time goes, only
+// needs the synced scene graph and the scene's own image, so that runs for
+// all scenes in parallel. Returns once all of them are done.
+QVector<QuickSceneManager::Update> QuickSceneManager::renderChangedScenes()
+{
+    QVector<Update> updates;
+    for (QuickScene *scene : qAsConst(m_scenes)) {
+        if (scene->isRunning() && scene->hasChanged()) {
+            Update u = { scene, QRegion() };
+            updates.append(u);
+        }
+    }
+
+    if (updates.isEmpty())
+        return updates;
+
+    {
+        ScopedStageTimer t(m_profiler, FrameProfiler::Sync);
+        for (const Update &u : qAsConst(updates))
+            u.scene->polishAndSync();
+    }
+
+    auto render = [](Update &u) {
+        u.dirtyRegion = u.scene->renderSynced();
+    };
+    {
+        ScopedStageTimer t(m_profiler, FrameProfiler::Render);
+        if (m_parallel && updates.count() > 1) {
+            QtConcurrent::blockingMap(updates, render);
+        } else {
+            for (Update &u : updates)
+                render(u);
+        }
+    }
+
+    QVector<Update> result;
+    for (const Update &u : qAsConst(updates)) {
+        if (!u.dirtyRegion.isEmpty())
+            result.append(u);
+    }
+    return result;
+}
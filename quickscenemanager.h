@@ -0,0 +1,172 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QUICKSCENEMANAGER_H
+#define QUICKSCENEMANAGER_H
+
+#include <QObject>
+#include <QImage>
+#include <QRegion>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QUrl>
+#include "atlasallocator.h"
+#include "renderscale.h"
+
+class QQuickRenderControl;
+class QQuickWindow;
+class QQuickItem;
+class QQmlEngine;
+class QQmlComponent;
+class FrameProfiler;
+
+// One independent QML panel, with its own render control and software
+// rendered image.
+class QuickScene : public QObject
+{
+    Q_OBJECT
+
+public:
+    QuickScene(QQmlEngine *engine, QWindow *renderWindow, const QUrl &url, const QSize &size);
+    ~QuickScene();
+
+    bool isRunning() const { return m_rootItem; }
+    bool hasChanged() const { return m_changed; }
+    bool hasRendered() const { return m_rendered; }
+    QSize size() const { return m_size; }
+    QQuickWindow *quickWindow() const { return m_quickWindow; }
+
+    // Model matrix of the panel's quad, a unit quad (-1..1) in the xy plane.
+    void setTransform(const QMatrix4x4 &m) { m_transform = m; }
+    QMatrix4x4 transform() const { return m_transform; }
+
+    QRect atlasRect() const { return m_atlasRect; }
+    void setAtlasRect(const QRect &rect) { m_atlasRect = rect; }
+
+    // The image is smaller than size() when rendering at a lower scale, it
+    // then only fills the top left of the atlas rect.
+    const QImage &image() const { return m_image; }
+    qreal renderScale() const { return m_renderScale.scale(); }
+    // Picks the render scale from the panel's size on screen, in pixels.
+    void updateFootprint(const QSizeF &pixelSize);
+
+    // Must be called on the GUI thread.
+    void polishAndSync();
+    // Safe to call on any thread after polishAndSync(), concurrently with
+    // the other scenes.
+    QRegion renderSynced();
+
+signals:
+    void changed();
+
+private slots:
+    void onStatusChanged();
+    void onSceneChanged();
+
+private:
+    void createImage();
+
+    QQuickRenderControl *m_renderControl;
+    QQuickWindow *m_quickWindow;
+    QQmlComponent *m_qmlComponent;
+    QQuickItem *m_rootItem = nullptr;
+    QSize m_size;
+    QImage m_image;
+    RenderScaleController m_renderScale;
+    bool m_imageFresh = false;
+    QMatrix4x4 m_transform;
+    QRect m_atlasRect;
+    bool m_changed = false;
+    bool m_rendered = false;
+};
+
+// Owns the panels and places them in a shared atlas, so that all of them
+// can be drawn from one texture with one instanced draw.
+class QuickSceneManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MAX_SCENES = 256;
+
+    QuickSceneManager(QWindow *renderWindow, const QSize &atlasSize, FrameProfiler *profiler);
+    ~QuickSceneManager();
+
+    QuickScene *addScene(const QUrl &url, const QSize &size, const QMatrix4x4 &transform);
+    void removeScene(QuickScene *scene);
+    QVector<QuickScene *> scenes() const { return m_scenes; }
+
+    QSize atlasSize() const { return m_atlas.size(); }
+    bool hasChanges() const;
+
+    // Rasterizes the changed scenes concurrently on the global thread pool.
+    // On by default.
+    void setParallelRendering(bool enable) { m_parallel = enable; }
+    bool isParallelRendering() const { return m_parallel; }
+
+    struct Update {
+        QuickScene *scene;
+        QRegion dirtyRegion; // in scene coordinates
+    };
+    QVector<Update> renderChangedScenes();
+
+signals:
+    void changed();
+
+private:
+    QWindow *m_renderWindow;
+    FrameProfiler *m_profiler;
+    QQmlEngine *m_qmlEngine;
+    AtlasAllocator m_atlas;
+    QVector<QuickScene *> m_scenes;
+    bool m_parallel = true;
+};
+
+#endif
@@ -0,0 +1,436 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "rectcopy.h"
+#include <QtMath>
+#include <QtCore/private/qsimd_p.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RECTCOPY_NEON
+#endif
+
+// Rects in the same band closer than this get copied as one span. Copying
+// a few unchanged pixels is cheaper than another round through the loop.
+static const int MAX_GAP_BYTES = 64;
+
+// Below this the setup for aligned streaming stores is not worth it.
+static const size_t STREAMING_THRESHOLD = 256;
+
+typedef void (*CopyFunc)(uchar *dst, const uchar *src, size_t bytes);
+
+static void copyScalar(uchar *dst, const uchar *src, size_t bytes)
+{
+    memcpy(dst, src, bytes);
+}
+
+#ifdef __SSE2__
+static void copySse2(uchar *dst, const uchar *src, size_t bytes)
+{
+    if (bytes < STREAMING_THRESHOLD) {
+        memcpy(dst, src, bytes);
+        return;
+    }
+
+    const size_t head = (16 - (quintptr(dst) & 15)) & 15;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    bytes -= head;
+
+    for (size_t n = bytes / 64; n; --n) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + 48), d);
+        src += 64;
+        dst += 64;
+    }
+    bytes &= 63;
+
+    for (; bytes >= 16; bytes -= 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+        src += 16;
+        dst += 16;
+    }
+
+    memcpy(dst, src, bytes);
+}
+#endif
+
+#if QT_COMPILER_SUPPORTS_HERE(AVX2)
+QT_FUNCTION_TARGET(AVX2)
+static void copyAvx2(uchar *dst, const uchar *src, size_t bytes)
+{
+    if (bytes < STREAMING_THRESHOLD) {
+        memcpy(dst, src, bytes);
+        return;
+    }
+
+    const size_t head = (32 - (quintptr(dst) & 31)) & 31;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    bytes -= head;
+
+    for (size_t n = bytes / 128; n; --n) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 96), d);
+        src += 128;
+        dst += 128;
+    }
+    bytes &= 127;
+
+    for (; bytes >= 32; bytes -= 32) {
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
+        src += 32;
+        dst += 32;
+    }
+
+    memcpy(dst, src, bytes);
+}
+#endif
+
+#ifdef RECTCOPY_NEON
+// There are no streaming store intrinsics, but wide unrolled copies still
+// beat memcpy on write-combined memory on most cores.
+static void copyNeon(uchar *dst, const uchar *src, size_t bytes)
+{
+    for (size_t n = bytes / 64; n; --n) {
+        const uint8x16_t a = vld1q_u8(src);
+        const uint8x16_t b = vld1q_u8(src + 16);
+        const uint8x16_t c = vld1q_u8(src + 32);
+        const uint8x16_t d = vld1q_u8(src + 48);
+        vst1q_u8(dst, a);
+        vst1q_u8(dst + 16, b);
+        vst1q_u8(dst + 32, c);
+        vst1q_u8(dst + 48, d);
+        src += 64;
+        dst += 64;
+    }
+    memcpy(dst, src, bytes & 63);
+}
+#endif
+
+struct Kernel {
+    CopyFunc copy;
+    const char *name;
+    bool streaming;
+};
+
+static const Kernel scalarKernel = { copyScalar, "scalar", false };
+#ifdef __SSE2__
+static const Kernel sse2Kernel = { copySse2, "sse2", true };
+#endif
+#if QT_COMPILER_SUPPORTS_HERE(AVX2)
+static const Kernel avx2Kernel = { copyAvx2, "avx2", true };
+#endif
+#ifdef RECTCOPY_NEON
+static const Kernel neonKernel = { copyNeon, "neon", false };
+#endif
+
+static Kernel resolveKernel()
+{
+#if QT_COMPILER_SUPPORTS_HERE(AVX2)
+    if (qCpuHasFeature(AVX2))
+        return avx2Kernel;
+#endif
+#ifdef __SSE2__
+    return sse2Kernel;
+#elif defined(RECTCOPY_NEON)
+    return neonKernel;
+#else
+    return scalarKernel;
+#endif
+}
+
+static const Kernel &bestKernel()
+{
+    static const Kernel kernel = resolveKernel();
+    return kernel;
+}
+
+const char *rectCopyKernelName()
+{
+    return bestKernel().name;
+}
+
+// The software renderer reports what it painted in logical coordinates.
+// Rects are scaled outwards to whole pixels, since antialiased edges touch
+// the partially covered ones, and clipped to the image.
+QRegion toImagePixels(const QRegion &region, const QImage &image)
+{
+    const QRect bounds(QPoint(0, 0), image.size());
+    const qreal dpr = image.devicePixelRatio();
+    if (dpr == 1)
+        return region & bounds;
+
+    QRegion pixels;
+    for (const QRect &r : region) {
+        const int x0 = qFloor(r.x() * dpr);
+        const int y0 = qFloor(r.y() * dpr);
+        const int x1 = qCeil((r.x() + r.width()) * dpr);
+        const int y1 = qCeil((r.y() + r.height()) * dpr);
+        pixels += QRect(x0, y0, x1 - x0, y1 - y0) & bounds;
+    }
+    return pixels;
+}
+
+// QRegion's rects are non-overlapping and sorted into bands. Merge nearby
+// rects within a band into one span, then merge spans that continue
+// exactly in the next band, so each row gets touched by as few copies as
+// possible.
+QVector<QRect> coalesceDirtyRects(const QRegion &region, int bpp)
+{
+    QVector<QRect> rects;
+    rects.reserve(region.rectCount());
+
+    for (const QRect &r : region) {
+        if (!rects.isEmpty()) {
+            QRect &prev(rects.last());
+            if (prev.y() == r.y() && prev.height() == r.height()
+                    && (r.x() - prev.x() - prev.width()) * bpp <= MAX_GAP_BYTES)
+            {
+                prev.setRight(r.right());
+                continue;
+            }
+        }
+        rects.append(r);
+    }
+
+    // Indices into merged of the rects ending in the previous and the
+    // current band.
+    QVector<QRect> merged;
+    merged.reserve(rects.count());
+    QVector<int> open;
+    QVector<int> current;
+    int bandY = -1;
+    int bandBottom = -2;
+    for (const QRect &r : qAsConst(rects)) {
+        if (r.y() != bandY) {
+            if (bandBottom + 1 == r.y())
+                open.swap(current);
+            else
+                open.clear();
+            current.clear();
+            bandY = r.y();
+            bandBottom = r.bottom();
+        }
+
+        int hit = -1;
+        for (int i : qAsConst(open)) {
+            if (merged[i].x() == r.x() && merged[i].width() == r.width()) {
+                hit = i;
+                break;
+            }
+        }
+
+        if (hit >= 0) {
+            merged[hit].setBottom(r.bottom());
+            current.append(hit);
+        } else {
+            current.append(merged.count());
+            merged.append(r);
+        }
+    }
+
+    return merged;
+}
+
+bool hasRectCopyKernel(RectCopyKernel kernel)
+{
+    switch (kernel) {
+    case AutoRectCopyKernel:
+    case ScalarRectCopyKernel:
+        return true;
+    case Sse2RectCopyKernel:
+#ifdef __SSE2__
+        return true;
+#else
+        return false;
+#endif
+    case Avx2RectCopyKernel:
+#if QT_COMPILER_SUPPORTS_HERE(AVX2)
+        return qCpuHasFeature(AVX2);
+#else
+        return false;
+#endif
+    case NeonRectCopyKernel:
+#ifdef RECTCOPY_NEON
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+static const Kernel &selectKernel(RectCopyKernel kernel)
+{
+    switch (kernel) {
+    case ScalarRectCopyKernel:
+        return scalarKernel;
+#ifdef __SSE2__
+    case Sse2RectCopyKernel:
+        return sse2Kernel;
+#endif
+#if QT_COMPILER_SUPPORTS_HERE(AVX2)
+    case Avx2RectCopyKernel:
+        return avx2Kernel;
+#endif
+#ifdef RECTCOPY_NEON
+    case NeonRectCopyKernel:
+        return neonKernel;
+#endif
+    default:
+        return bestKernel();
+    }
+}
+
+static inline void finishCopies(const Kernel &k)
+{
+#ifdef __SSE2__
+    // Make the streaming stores globally visible before the memory gets
+    // flushed or handed over to the GPU.
+    if (k.streaming)
+        _mm_sfence();
+#else
+    Q_UNUSED(k);
+#endif
+}
+
+static inline size_t alignedOffset(size_t v, size_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+void copyDirtyRects(uchar *dst, size_t dstPitch, const QImage &src, const QVector<QRect> &rects,
+                    RectCopyKernel kernel)
+{
+    const Kernel &k(selectKernel(kernel));
+
+    const int bpp = src.depth() / 8;
+    const size_t srcPitch = src.bytesPerLine();
+    const uchar *srcBits = src.constBits();
+
+    for (const QRect &r : rects) {
+        const size_t rowBytes = size_t(r.width()) * bpp;
+        const uchar *s = srcBits + r.y() * srcPitch + r.x() * bpp;
+        uchar *d = dst + r.y() * dstPitch + r.x() * bpp;
+
+        // Full rows with matching pitches are one contiguous block.
+        if (r.x() == 0 && r.width() == src.width() && srcPitch == dstPitch) {
+            k.copy(d, s, (r.height() - 1) * srcPitch + rowBytes);
+            continue;
+        }
+
+        for (int y = 0; y < r.height(); ++y) {
+            k.copy(d, s, rowBytes);
+            s += srcPitch;
+            d += dstPitch;
+        }
+    }
+
+    finishCopies(k);
+}
+
+// Size of a buffer holding the rects back to back, each one tightly packed
+// and starting at a multiple of alignment.
+size_t packedRectsSize(const QVector<QRect> &rects, int bpp, size_t alignment)
+{
+    size_t size = 0;
+    for (const QRect &r : rects)
+        size = alignedOffset(size, alignment) + size_t(r.width()) * r.height() * bpp;
+    return size;
+}
+
+void copyRectsPacked(uchar *dst, const QImage &src, const QVector<QRect> &rects, size_t alignment,
+                     QVector<size_t> *offsets, RectCopyKernel kernel)
+{
+    const Kernel &k(selectKernel(kernel));
+
+    const int bpp = src.depth() / 8;
+    const size_t srcPitch = src.bytesPerLine();
+    const uchar *srcBits = src.constBits();
+    size_t offset = 0;
+
+    offsets->resize(rects.count());
+    for (int i = 0; i < rects.count(); ++i) {
+        const QRect &r(rects[i]);
+        const size_t rowBytes = size_t(r.width()) * bpp;
+        const uchar *s = srcBits + r.y() * srcPitch + r.x() * bpp;
+        offset = alignedOffset(offset, alignment);
+        (*offsets)[i] = offset;
+
+        if (r.x() == 0 && r.width() == src.width() && srcPitch == rowBytes) {
+            k.copy(dst + offset, s, rowBytes * r.height());
+            offset += rowBytes * r.height();
+            continue;
+        }
+
+        for (int y = 0; y < r.height(); ++y) {
+            k.copy(dst + offset, s, rowBytes);
+            s += srcPitch;
+            offset += rowBytes;
+        }
+    }
+
+    finishCopies(k);
+}
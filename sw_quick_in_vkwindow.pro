@@ -1,12 +1,38 @@
 TEMPLATE = app
 
-QT = core gui qml quick quick-private
+QT = core gui qml quick quick-private core-private gui-private concurrent
 
 SOURCES = \
     main.cpp \
-    vulkanwindow.cpp
+    vulkanwindow.cpp \
+    quickrenderthread.cpp \
+    rectcopy.cpp \
+    frameprofiler.cpp \
+    atlasallocator.cpp \
+    quickscenemanager.cpp \
+    tiledquickrenderer.cpp \
+    bcencoder.cpp \
+    tilecache.cpp \
+    renderscale.cpp \
+    quadhit.cpp \
+    framepacer.cpp \
+    gpumemory.cpp \
+    incrementalpresent.cpp
 
 HEADERS = \
-    vulkanwindow.h
+    vulkanwindow.h \
+    quickrenderthread.h \
+    rectcopy.h \
+    frameprofiler.h \
+    atlasallocator.h \
+    quickscenemanager.h \
+    tiledquickrenderer.h \
+    bcencoder.h \
+    tilecache.h \
+    renderscale.h \
+    quadhit.h \
+    framepacer.h \
+    gpumemory.h \
+    incrementalpresent.h
 
 RESOURCES = sw_quick_in_vkwindow.qrc
@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = tst_rectcopy
+
+QT = core gui testlib core-private
+CONFIG += testcase
+
+INCLUDEPATH += ../..
+
+SOURCES = \
+    tst_rectcopy.cpp \
+    ../../rectcopy.cpp
+
+HEADERS = \
+    ../../rectcopy.h
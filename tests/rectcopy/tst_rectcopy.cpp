@@ -0,0 +1,281 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Checks the SIMD copy kernels against the plain memcpy one, and that
+// coalescing dirty rects never loses any of the region.
+
+#include <QtTest>
+#include <QImage>
+#include <QRegion>
+#include <QVector>
+#include <random>
+#include "rectcopy.h"
+
+Q_DECLARE_METATYPE(RectCopyKernel)
+Q_DECLARE_METATYPE(QImage::Format)
+
+// Sizes where a row is well past the streaming threshold of the SIMD
+// kernels, and odd enough that rows do not end on a vector boundary.
+static const int IMAGE_WIDTH = 301;
+static const int IMAGE_HEIGHT = 67;
+static const int REGION_COUNT = 50;
+// Filler for the destination, any write outside the rects shows up.
+static const uchar CANARY = 0xcd;
+
+static QImage randomImage(QImage::Format format, std::mt19937 *rng)
+{
+    QImage image(IMAGE_WIDTH, IMAGE_HEIGHT, format);
+    uchar *bits = image.bits();
+    for (int i = 0; i < image.bytesPerLine() * image.height(); ++i)
+        bits[i] = uchar((*rng)());
+    return image;
+}
+
+// Mostly small rects, some full width ones for the contiguous path, and
+// now and then the whole image.
+static QRegion randomRegion(std::mt19937 *rng)
+{
+    const QRect bounds(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::uniform_int_distribution<int> x(0, IMAGE_WIDTH - 1);
+    std::uniform_int_distribution<int> y(0, IMAGE_HEIGHT - 1);
+    std::uniform_int_distribution<int> count(1, 12);
+
+    if (kind(*rng) == 0)
+        return bounds;
+
+    QRegion region;
+    for (int n = count(*rng); n; --n) {
+        if (kind(*rng) < 2) {
+            region += QRect(0, y(*rng), IMAGE_WIDTH, 1 + y(*rng) / 4) & bounds;
+        } else {
+            const int x0 = x(*rng);
+            const int y0 = y(*rng);
+            region += QRect(x0, y0, 1 + x(*rng) / 2, 1 + y(*rng) / 2) & bounds;
+        }
+    }
+    return region;
+}
+
+class tst_RectCopy : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void copyDirtyRects_data();
+    void copyDirtyRects();
+    void copyRectsPacked_data();
+    void copyRectsPacked();
+    void coalesceDirtyRects_data();
+    void coalesceDirtyRects();
+    void coalesceMerges();
+};
+
+static void addKernelRows()
+{
+    QTest::addColumn<RectCopyKernel>("kernel");
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<int>("pitchPadding");
+    QTest::addColumn<int>("dstOffset");
+
+    const struct { RectCopyKernel kernel; const char *name; } kernels[] = {
+        { Sse2RectCopyKernel, "sse2" },
+        { Avx2RectCopyKernel, "avx2" },
+        { NeonRectCopyKernel, "neon" }
+    };
+    const struct { QImage::Format format; const char *name; } formats[] = {
+        { QImage::Format_Grayscale8, "8bpp" },
+        { QImage::Format_RGB16, "16bpp" },
+        { QImage::Format_RGB888, "24bpp" },
+        { QImage::Format_ARGB32_Premultiplied, "32bpp" }
+    };
+    const int paddings[] = { 0, 4, 100 };
+    const int offsets[] = { 0, 3, 16 };
+
+    for (const auto &k : kernels) {
+        for (const auto &f : formats) {
+            for (int padding : paddings) {
+                for (int offset : offsets) {
+                    QTest::newRow(QByteArray(k.name) + ' ' + f.name + " padding " + QByteArray::number(padding)
+                                  + " offset " + QByteArray::number(offset))
+                        << k.kernel << f.format << padding << offset;
+                }
+            }
+        }
+    }
+}
+
+void tst_RectCopy::copyDirtyRects_data()
+{
+    addKernelRows();
+}
+
+void tst_RectCopy::copyDirtyRects()
+{
+    QFETCH(RectCopyKernel, kernel);
+    QFETCH(QImage::Format, format);
+    QFETCH(int, pitchPadding);
+    QFETCH(int, dstOffset);
+
+    if (!hasRectCopyKernel(kernel))
+        QSKIP("Kernel not available on this CPU");
+
+    std::mt19937 rng(1234);
+    const QImage src = randomImage(format, &rng);
+    const int bpp = src.depth() / 8;
+    const size_t pitch = src.bytesPerLine() + pitchPadding;
+    const int size = dstOffset + int(pitch) * src.height();
+
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        const QVector<QRect> rects = ::coalesceDirtyRects(randomRegion(&rng), bpp);
+
+        QByteArray expected(size, char(CANARY));
+        ::copyDirtyRects(reinterpret_cast<uchar *>(expected.data()) + dstOffset, pitch, src, rects,
+                         ScalarRectCopyKernel);
+        QByteArray actual(size, char(CANARY));
+        ::copyDirtyRects(reinterpret_cast<uchar *>(actual.data()) + dstOffset, pitch, src, rects, kernel);
+
+        QVERIFY(actual == expected);
+    }
+}
+
+void tst_RectCopy::copyRectsPacked_data()
+{
+    addKernelRows();
+}
+
+// The pitch padding becomes the alignment of the packed rects here.
+void tst_RectCopy::copyRectsPacked()
+{
+    QFETCH(RectCopyKernel, kernel);
+    QFETCH(QImage::Format, format);
+    QFETCH(int, pitchPadding);
+    QFETCH(int, dstOffset);
+
+    if (!hasRectCopyKernel(kernel))
+        QSKIP("Kernel not available on this CPU");
+
+    std::mt19937 rng(5678);
+    const QImage src = randomImage(format, &rng);
+    const int bpp = src.depth() / 8;
+    const size_t alignment = qMax(1, pitchPadding);
+
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        const QVector<QRect> rects = ::coalesceDirtyRects(randomRegion(&rng), bpp);
+        const int size = dstOffset + int(packedRectsSize(rects, bpp, alignment));
+
+        QByteArray expected(size, char(CANARY));
+        QVector<size_t> expectedOffsets;
+        ::copyRectsPacked(reinterpret_cast<uchar *>(expected.data()) + dstOffset, src, rects, alignment,
+                          &expectedOffsets, ScalarRectCopyKernel);
+        QByteArray actual(size, char(CANARY));
+        QVector<size_t> actualOffsets;
+        ::copyRectsPacked(reinterpret_cast<uchar *>(actual.data()) + dstOffset, src, rects, alignment,
+                          &actualOffsets, kernel);
+
+        QCOMPARE(actualOffsets, expectedOffsets);
+        QVERIFY(actual == expected);
+    }
+}
+
+void tst_RectCopy::coalesceDirtyRects_data()
+{
+    QTest::addColumn<int>("bpp");
+
+    QTest::newRow("8bpp") << 1;
+    QTest::newRow("32bpp") << 4;
+}
+
+// Coalesced rects may cover a little more than the region, but never less,
+// never overlap, and stay within the region's bounds.
+void tst_RectCopy::coalesceDirtyRects()
+{
+    QFETCH(int, bpp);
+
+    std::mt19937 rng(91011);
+    for (int i = 0; i < REGION_COUNT; ++i) {
+        const QRegion region = randomRegion(&rng);
+        const QVector<QRect> rects = ::coalesceDirtyRects(region, bpp);
+
+        QVERIFY(rects.count() <= region.rectCount());
+        QRegion covered;
+        for (const QRect &r : rects) {
+            QVERIFY(region.boundingRect().contains(r));
+            QVERIFY(!covered.intersects(r));
+            covered += r;
+        }
+        QVERIFY((region - covered).isEmpty());
+    }
+}
+
+void tst_RectCopy::coalesceMerges()
+{
+    // A small gap within a band is copied along.
+    QRegion region;
+    region += QRect(0, 0, 10, 5);
+    region += QRect(14, 0, 10, 5);
+    QCOMPARE(::coalesceDirtyRects(region, 4), QVector<QRect>() << QRect(0, 0, 24, 5));
+
+    // A large one is not.
+    region = QRect(0, 0, 10, 5);
+    region += QRect(100, 0, 10, 5);
+    QCOMPARE(::coalesceDirtyRects(region, 4).count(), 2);
+
+    // Spans continuing in the next band become one rect again, even when
+    // QRegion split them up.
+    region = QRect(0, 0, 10, 5);
+    region += QRect(50, 2, 10, 5);
+    QCOMPARE(region.rectCount(), 4);
+    QCOMPARE(::coalesceDirtyRects(region, 4), QVector<QRect>() << QRect(0, 0, 10, 5) << QRect(50, 2, 10, 5));
+}
+
+QTEST_APPLESS_MAIN(tst_RectCopy)
+
+#include "tst_rectcopy.moc"
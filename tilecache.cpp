@@ -0,0 +1,169 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "tilecache.h"
+
+void TileCache::reset(const QSize &textureSize, const QSize &poolSize)
+{
+    m_gridSize = textureSize / TILE_SIZE;
+    m_poolColumns = poolSize.width() / TILE_SIZE;
+    const int slotCount = m_poolColumns * (poolSize.height() / TILE_SIZE);
+
+    const Tile cold = { -1, 0 };
+    m_tiles.fill(cold, m_gridSize.width() * m_gridSize.height());
+    m_indirection.fill(0, m_tiles.count());
+    m_slotOwner.fill(-1, slotCount);
+    // Hand out the slots from the top left.
+    m_freeSlots.resize(slotCount);
+    for (int i = 0; i < slotCount; ++i)
+        m_freeSlots[i] = slotCount - 1 - i;
+}
+
+QRect TileCache::tileRect(int index) const
+{
+    return QRect((index % m_gridSize.width()) * TILE_SIZE, (index / m_gridSize.width()) * TILE_SIZE,
+                 TILE_SIZE, TILE_SIZE);
+}
+
+QPoint TileCache::slotPos(int slot) const
+{
+    return QPoint((slot % m_poolColumns) * TILE_SIZE, (slot / m_poolColumns) * TILE_SIZE);
+}
+
+void TileCache::makeHot(int index, int slot, quint64 frame)
+{
+    Tile &t(m_tiles[index]);
+    t.slot = slot;
+    t.lastChange = frame;
+    m_slotOwner[slot] = index;
+    m_indirection[index] = quint32(slot % m_poolColumns) | (quint32(slot / m_poolColumns) << 8) | 0xFF000000;
+}
+
+void TileCache::makeCold(int index)
+{
+    Tile &t(m_tiles[index]);
+    m_slotOwner[t.slot] = -1;
+    m_freeSlots.append(t.slot);
+    t.slot = -1;
+    m_indirection[index] = 0;
+}
+
+// Frees the slot of the hot tile that has been stable for the longest time.
+// Tiles that changed in this frame stay. Returns the owner, or -1 when
+// there was nothing to evict.
+int TileCache::evictFor(quint64 frame)
+{
+    int victim = -1;
+    for (int index : qAsConst(m_slotOwner)) {
+        if (index >= 0 && m_tiles[index].lastChange < frame
+                && (victim < 0 || m_tiles[index].lastChange < m_tiles[victim].lastChange))
+            victim = index;
+    }
+    if (victim >= 0)
+        makeCold(victim);
+    return victim;
+}
+
+void TileCache::update(const QRegion &dirtyRegion, quint64 frame, int maxCoolDowns, Update *update)
+{
+    const QRect bounds(QPoint(0, 0), m_gridSize * TILE_SIZE);
+
+    // Each touched tile once, in region order.
+    QVector<int> dirtyTiles;
+    QVector<bool> seen(m_tiles.count(), false);
+    for (const QRect &r : dirtyRegion) {
+        const QRect clipped = r & bounds;
+        if (clipped.isEmpty())
+            continue;
+        for (int y = clipped.top() / TILE_SIZE; y <= clipped.bottom() / TILE_SIZE; ++y) {
+            for (int x = clipped.left() / TILE_SIZE; x <= clipped.right() / TILE_SIZE; ++x) {
+                const int index = y * m_gridSize.width() + x;
+                if (!seen[index]) {
+                    seen[index] = true;
+                    dirtyTiles.append(index);
+                }
+            }
+        }
+    }
+
+    for (int index : qAsConst(dirtyTiles)) {
+        Tile &t(m_tiles[index]);
+        if (t.slot >= 0) {
+            t.lastChange = frame;
+            update->hotWrites.append({ tileRect(index), slotPos(t.slot), false });
+            continue;
+        }
+
+        if (m_freeSlots.isEmpty()) {
+            const int evicted = evictFor(frame);
+            if (evicted < 0) {
+                // The whole pool is busy, compress this one right away.
+                update->encodes.append(tileRect(index));
+                continue;
+            }
+            update->encodes.append(tileRect(evicted));
+        }
+
+        const int slot = m_freeSlots.takeLast();
+        makeHot(index, slot, frame);
+        update->hotWrites.append({ tileRect(index), slotPos(slot), true });
+        update->indirectionChanged = true;
+    }
+
+    for (int slot = 0; slot < m_slotOwner.count() && maxCoolDowns > 0; ++slot) {
+        const int index = m_slotOwner[slot];
+        if (index >= 0 && frame - m_tiles[index].lastChange >= COLD_AFTER_FRAMES) {
+            update->encodes.append(tileRect(index));
+            makeCold(index);
+            update->indirectionChanged = true;
+            --maxCoolDowns;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QRegion>
+#include <QVector>
+
+// Decides which tiles of a texture are kept uncompressed ("hot") in a fixed
+// pool of slots, and which ones live in the block compressed copy ("cold").
+// Tiles become hot when they change and go cold again once they have been
+// stable for a while, or when their slot is needed for a busier tile. Only
+// does the bookkeeping, the caller encodes and uploads.
+class TileCache
+{
+public:
+    static const int TILE_SIZE = 64;
+    // Frames without a change before a hot tile gets compressed.
+    static const int COLD_AFTER_FRAMES = 60;
+
+    struct HotWrite {
+        QRect tile;
+        // Top left of the tile's slot in the pool.
+        QPoint slot;
+        // The slot was just assigned, the whole tile has to be written.
+        bool full;
+    };
+
+    struct Update {
+        QVector<HotWrite> hotWrites;
+        // Tiles to encode and upload to the compressed copy.
+        QVector<QRect> encodes;
+        bool indirectionChanged = false;
+    };
+
+    // Both sizes in pixels, multiples of TILE_SIZE.
+    void reset(const QSize &textureSize, const QSize &poolSize);
+
+    QSize gridSize() const { return m_gridSize; }
+    int hotTileCount() const { return m_slotOwner.count() - m_freeSlots.count(); }
+
+    // Moves the tiles touched by dirtyRegion into the pool where possible,
+    // and at most maxCoolDowns stable ones out of it.
+    void update(const QRegion &dirtyRegion, quint64 frame, int maxCoolDowns, Update *update);
+
+    // One RGBA8 texel per tile, slot x and y in red and green, alpha 255
+    // for hot tiles.
+    const QVector<quint32> &indirection() const { return m_indirection; }
+
+private:
+    struct Tile {
+        int slot;
+        quint64 lastChange;
+    };
+
+    QRect tileRect(int index) const;
+    QPoint slotPos(int slot) const;
+    void makeHot(int index, int slot, quint64 frame);
+    void makeCold(int index);
+    int evictFor(quint64 frame);
+
+    QSize m_gridSize;
+    int m_poolColumns = 0;
+    QVector<Tile> m_tiles;
+    QVector<int> m_slotOwner;
+    QVector<int> m_freeSlots;
+    QVector<quint32> m_indirection;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#version 440
+
+layout(location = 0) in vec2 v_texcoord;
+
+layout(location = 0) out vec4 fragColor;
+
+// Block compressed copy of the whole texture.
+layout(binding = 0) uniform sampler2D coldTex;
+// Uncompressed slots for the tiles that are changing.
+layout(binding = 1) uniform sampler2D hotTex;
+// One texel per tile: slot in xy (times 255), 1 in alpha when hot.
+layout(binding = 2) uniform sampler2D tileTex;
+
+const float TILE = 64.0;
+
+void main()
+{
+    vec2 grid = vec2(textureSize(tileTex, 0));
+    vec2 t = v_texcoord * grid;
+    ivec2 tileCoord = ivec2(min(t, grid - 1.0));
+    vec4 tile = texelFetch(tileTex, tileCoord, 0);
+    // Stay half a texel inside the slot, the neighbors belong to other tiles.
+    vec2 inTile = clamp(fract(t) * TILE, 0.5, TILE - 0.5);
+    vec2 hotUv = (tile.xy * (255.0 * TILE) + inTile) / vec2(textureSize(hotTex, 0));
+    // The same for the cold copy, the neighbors there may be hot and never
+    // have been encoded.
+    vec2 coldUv = (vec2(tileCoord) * TILE + inTile) / vec2(textureSize(coldTex, 0));
+    fragColor = mix(texture(coldTex, coldUv), texture(hotTex, hotUv), tile.a);
+}
@@ -0,0 +1,255 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "tiledquickrenderer.h"
+#include <QQuickWindow>
+#include <QImage>
+#include <QPainter>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <QtQuick/private/qquickwindow_p.h>
+#include <QtQuick/private/qsgabstractsoftwarerenderer_p.h>
+
+// Band boundaries have to fall on whole device pixels, otherwise two bands
+// both paint the row in between, at the same time and each with its own
+// share of the antialiasing. They are kept at multiples of the smallest
+// height that is a whole number of device pixels, which is the denominator
+// of the device pixel ratio. Ratios that need more than this get one band.
+static const int MAX_TILE_ALIGN = 64;
+
+static int tileAlignment(qreal dpr)
+{
+    for (int align = 1; align <= MAX_TILE_ALIGN; ++align) {
+        const qreal pixels = dpr * align;
+        if (qAbs(pixels - qRound(pixels)) < 0.0001)
+            return align;
+    }
+    return 0;
+}
+
+// Same as QSGSoftwareRenderer::render(), but with the rendering area limited
+// to one band, which the software renderer then clips every node to.
+class TileRenderer : public QSGAbstractSoftwareRenderer
+{
+public:
+    TileRenderer(QSGRenderContext *context) : QSGAbstractSoftwareRenderer(context) { }
+
+    void setTile(const QRect &rect) { m_tile = rect; }
+    QRect tile() const { return m_tile; }
+
+    void setTarget(QImage *image) { m_target = image; }
+    QRegion flushRegion() const { return m_flushRegion; }
+
+    // Runs the preprocess step of the nodes that need one. Not thread safe,
+    // only one of the renderers does this.
+    void preprocessNodes() { preprocess(); }
+
+    void render() override;
+    void nodeChanged(QSGNode *node, QSGNode::DirtyState state) override;
+
+    bool hasChanges() const { return m_changed; }
+
+private:
+    bool m_changed = false;
+    QRect m_tile;
+    QImage *m_target = nullptr;
+    QRegion m_flushRegion;
+};
+
+void TileRenderer::render()
+{
+    setBackgroundColor(clearColor());
+    setBackgroundRect(m_tile);
+
+    buildRenderList();
+    optimizeRenderList();
+
+    QPainter painter(m_target);
+    painter.setRenderHint(QPainter::Antialiasing);
+    m_flushRegion = renderNodes(&painter);
+    m_changed = false;
+}
+
+void TileRenderer::nodeChanged(QSGNode *node, QSGNode::DirtyState state)
+{
+    m_changed = true;
+    QSGAbstractSoftwareRenderer::nodeChanged(node, state);
+}
+
+TiledQuickRenderer::TiledQuickRenderer(QQuickWindow *window)
+    : m_window(window)
+{
+}
+
+TiledQuickRenderer::~TiledQuickRenderer()
+{
+    // Detaches them from the root node.
+    qDeleteAll(m_tiles);
+    delete m_warmUp;
+}
+
+bool TiledQuickRenderer::hasChanges() const
+{
+    for (TileRenderer *r : m_tiles) {
+        if (r->hasChanges())
+            return true;
+    }
+    return false;
+}
+
+void TiledQuickRenderer::updateTiles(const QSize &size, qreal dpr)
+{
+    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_window);
+
+    const int align = tileAlignment(dpr);
+    const int count = align ? qBound(1, size.height() / qMax<int>(MIN_TILE_HEIGHT, align),
+                                     QThreadPool::globalInstance()->maxThreadCount()) : 1;
+    while (m_tiles.count() > count)
+        delete m_tiles.takeLast();
+    while (m_tiles.count() < count) {
+        // A new renderer starts out with everything dirty.
+        TileRenderer *r = new TileRenderer(wd->context);
+        r->setRootNode(wd->renderer->rootNode());
+        m_tiles.append(r);
+    }
+
+    // The warm-up pass has to cover everything a new band paints.
+    if (count > 1 && !m_warmUp) {
+        m_warmUp = new TileRenderer(wd->context);
+        m_warmUp->setRootNode(wd->renderer->rootNode());
+    } else if (count == 1) {
+        delete m_warmUp;
+        m_warmUp = nullptr;
+    }
+    if (m_warmUp) {
+        m_warmUp->markDirty();
+        m_warmUp->setTile(QRect(QPoint(0, 0), size));
+    }
+
+    int tileHeight = (size.height() + count - 1) / count;
+    if (count > 1)
+        tileHeight = (tileHeight + align - 1) / align * align;
+    for (int i = 0; i < count; ++i) {
+        const int y = i * tileHeight;
+        m_tiles[i]->setTile(QRect(0, y, size.width(), qMax(0, qMin(tileHeight, size.height() - y))));
+    }
+
+    m_size = size;
+    m_dpr = dpr;
+}
+
+QRegion TiledQuickRenderer::render(QImage *image)
+{
+    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_window);
+    if (!wd->renderer)
+        return QRegion();
+
+    // Same as the rendering area QSGSoftwareRenderer uses.
+    const QSize size = image->size() / image->devicePixelRatio();
+    if (size != m_size || image->devicePixelRatio() != m_dpr)
+        updateTiles(size, image->devicePixelRatio());
+
+    // A new image has undefined contents. The serial number only changes
+    // when the image is replaced, unlike the rest of cacheKey().
+    const qint64 serial = image->cacheKey() >> 32;
+    if (serial != m_imageSerial) {
+        m_imageSerial = serial;
+        for (TileRenderer *r : qAsConst(m_tiles))
+            r->markDirty();
+        if (m_warmUp)
+            m_warmUp->markDirty();
+    }
+
+    // Every band paints through its own QImage, a QImage cannot have more
+    // than one active painter. They all share the pixel data, which gets
+    // detached here, on this thread, if needed.
+    uchar *bits = image->bits();
+    QVector<QImage> targets;
+    targets.reserve(m_tiles.count());
+    for (TileRenderer *r : qAsConst(m_tiles)) {
+        QImage target(bits, image->width(), image->height(), image->bytesPerLine(), image->format());
+        target.setDevicePixelRatio(image->devicePixelRatio());
+        targets.append(target);
+        r->setClearColor(m_window->color());
+    }
+    for (int i = 0; i < m_tiles.count(); ++i)
+        m_tiles[i]->setTarget(&targets[i]);
+
+    m_tiles.first()->preprocessNodes();
+
+    // Nodes are shared by all bands, and painting some of them is not
+    // thread safe: rectangles regenerate their corner pixmap for a new
+    // device pixel ratio, images cache their mirrored pixmap, and text
+    // fills the glyph caches of font engines that other nodes use as well.
+    // One more renderer paints everything that any band is about to paint,
+    // here, into an image with the same device pixel ratio that clips it all
+    // away, so those caches are filled and only read in the parallel pass.
+    if (m_warmUp) {
+        QImage scratch(1, 1, image->format());
+        scratch.setDevicePixelRatio(image->devicePixelRatio());
+        m_warmUp->setTarget(&scratch);
+        m_warmUp->setClearColor(m_window->color());
+        m_warmUp->render();
+        m_warmUp->setTarget(nullptr);
+    }
+
+    QtConcurrent::blockingMap(m_tiles, [](TileRenderer *r) {
+        if (!r->tile().isEmpty())
+            r->render();
+    });
+
+    QRegion flushRegion;
+    for (TileRenderer *r : qAsConst(m_tiles)) {
+        flushRegion += r->flushRegion();
+        r->setTarget(nullptr);
+    }
+    return flushRegion;
+}
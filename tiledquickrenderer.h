@@ -0,0 +1,96 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the examples of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:BSD$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** BSD License Usage
+** Alternatively, you may use this file under the terms of the BSD license
+** as follows:
+**
+** "Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**   * Redistributions of source code must retain the above copyright
+**     notice, this list of conditions and the following disclaimer.
+**   * Redistributions in binary form must reproduce the above copyright
+**     notice, this list of conditions and the following disclaimer in
+**     the documentation and/or other materials provided with the
+**     distribution.
+**   * Neither the name of The Qt Company Ltd nor the names of its
+**     contributors may be used to endorse or promote products derived
+**     from this software without specific prior written permission.
+**
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+** LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+** A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+** LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+** OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef TILEDQUICKRENDERER_H
+#define TILEDQUICKRENDERER_H
+
+#include <QVector>
+#include <QRegion>
+
+class QQuickWindow;
+class QImage;
+class TileRenderer;
+
+// Rasterizes one software scene graph in horizontal bands, all of them in
+// parallel. Each band has its own renderer attached to the window's root
+// node, so they all see the result of the same sync but keep their own
+// render lists and dirty state, and only ever paint inside their band.
+// Node state that painting fills in lazily is filled in on the calling
+// thread first.
+class TiledQuickRenderer
+{
+public:
+    // Bands are never smaller than this, in device independent pixels.
+    static const int MIN_TILE_HEIGHT = 64;
+
+    TiledQuickRenderer(QQuickWindow *window);
+    ~TiledQuickRenderer();
+
+    // To be called on the GUI thread after sync, instead of
+    // QQuickRenderControl::render(). Returns the changed area.
+    QRegion render(QImage *image);
+
+    int tileCount() const { return m_tiles.count(); }
+
+    // Whether any sync since the last render() touched the scene graph.
+    bool hasChanges() const;
+
+private:
+    void updateTiles(const QSize &size, qreal dpr);
+
+    QQuickWindow *m_window;
+    QVector<TileRenderer *> m_tiles;
+    TileRenderer *m_warmUp = nullptr;
+    QSize m_size;
+    qreal m_dpr = 0;
+    qint64 m_imageSerial = 0;
+};
+
+#endif
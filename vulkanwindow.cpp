@@ -49,21 +49,56 @@
 ****************************************************************************/
 
 #include "vulkanwindow.h"
+#include "quickrenderthread.h"
+#include "rectcopy.h"
+#include "quickscenemanager.h"
+#include "tiledquickrenderer.h"
+#include "bcencoder.h"
+#include "quadhit.h"
+#include "incrementalpresent.h"
 #include <QVulkanFunctions>
 #include <QMatrix4x4>
 #include <QScreen>
 #include <QFile>
+#include <QSaveFile>
+#include <QDir>
+#include <QStandardPaths>
+#include <QtEndian>
+#include <QVarLengthArray>
+#include <QtMath>
 #include <QQuickRenderControl>
 #include <QQuickWindow>
 #include <QQuickItem>
 #include <QQmlEngine>
 #include <QQmlComponent>
+#include <QTimer>
+#include <QMouseEvent>
+#include <QTouchEvent>
+#include <QWheelEvent>
+#include <QKeyEvent>
 
 #include <QtQuick/private/qquickwindow_p.h>
 #include <QtQuick/private/qsgsoftwarerenderer_p.h>
 
 static const int QUICK_W = 512;
 static const int QUICK_H = 512;
+static const int RESIZE_DEBOUNCE_MSECS = 100;
+static const int ATLAS_SIZE = 2048;
+// Queued input is delivered right away beyond this, in case no frames come.
+static const int MAX_QUEUED_INPUT = 256;
+
+// Offsets of buffer to image copies must be a multiple of the texel size, 16
+// keeps the SIMD copies aligned too.
+static const VkDeviceSize UPLOAD_ALIGN = 16;
+// Per-instance data of a panel: mat4 mvp, vec4 uvRect.
+static const VkDeviceSize PANEL_INSTANCE_SIZE = 20 * sizeof(float);
+
+// Linear filtering reaches into the pixels around a changed area.
+static const int DAMAGE_MARGIN = 2;
+// Uncompressed tile slots in compressed mode, 16x16 tiles.
+static const int HOT_POOL_SIZE = 1024;
+// Stable tiles compressed per frame, on top of those that have to be.
+static const int MAX_COOL_DOWNS_PER_FRAME = 8;
 
 static float vertexData[] = {
     // x, y, z, u, v
@@ -78,6 +113,39 @@ static inline VkDeviceSize aligned(VkDeviceSize v, VkDeviceSize byteAlign)
     return (v + byteAlign - 1) & ~(byteAlign - 1);
 }
 
+// The Vulkan format with the memory layout of a Quick image format.
+// ARGB4444 and Grayscale8 need a swizzle on top, see
+// createTextureImageView().
+static VkFormat textureFormat(QImage::Format format, int *bpp)
+{
+    switch (format) {
+    case QImage::Format_RGB16:
+        *bpp = 2;
+        return VK_FORMAT_R5G6B5_UNORM_PACK16;
+    case QImage::Format_ARGB4444_Premultiplied:
+        *bpp = 2;
+        return VK_FORMAT_B4G4R4A4_UNORM_PACK16;
+    case QImage::Format_Grayscale8:
+        *bpp = 1;
+        return VK_FORMAT_R8_UNORM;
+    default:
+        *bpp = 4;
+        return VK_FORMAT_B8G8R8A8_UNORM;
+    }
+}
+
+// Widens the rects to the left so that they start at a multiple of texels.
+static QRegion alignedLeft(const QRegion &region, int texels)
+{
+    QRegion result;
+    for (const QRect &r : region) {
+        QRect a(r);
+        a.setLeft(r.left() / texels * texels);
+        result += a;
+    }
+    return result;
+}
+
 class RenderControl : public QQuickRenderControl
 {
 public:
@@ -96,6 +164,8 @@ QWindow *RenderControl::renderWindow(QPoint *offset)
 }
 
 VulkanWindowWithSwQuick::VulkanWindowWithSwQuick()
+    : m_quickSize(QUICK_W, QUICK_H),
+      m_pipelineCacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
 {
     // The key: force the software backend.
     QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
@@ -109,27 +179,195 @@ VulkanWindowWithSwQuick::VulkanWindowWithSwQuick()
     if (!m_qmlEngine->incubationController())
         m_qmlEngine->setIncubationController(m_quickWindow->incubationController());
 
-    connect(m_renderControl, &QQuickRenderControl::renderRequested, [this] { m_quickSceneChanged = true; });
-    connect(m_renderControl, &QQuickRenderControl::sceneChanged, [this] { m_quickSceneChanged = true; });
+    connect(m_renderControl, &QQuickRenderControl::renderRequested, this, &VulkanWindowWithSwQuick::onQuickSceneChanged);
+    connect(m_renderControl, &QQuickRenderControl::sceneChanged, this, &VulkanWindowWithSwQuick::onQuickSceneChanged);
     connect(this, &QWindow::screenChanged, this, &VulkanWindowWithSwQuick::onScreenChanged);
+
+    m_keepAliveTimer = new QTimer(this);
+    connect(m_keepAliveTimer, &QTimer::timeout, this, &QWindow::requestUpdate);
+
+    // Interactive resizes generate a stream of resize events, only the last
+    // one matters for the Quick scene.
+    m_resizeTimer = new QTimer(this);
+    m_resizeTimer->setSingleShot(true);
+    m_resizeTimer->setInterval(RESIZE_DEBOUNCE_MSECS);
+    connect(m_resizeTimer, &QTimer::timeout, this, &VulkanWindowWithSwQuick::applyWindowSize);
 }
 
 VulkanWindowWithSwQuick::~VulkanWindowWithSwQuick()
 {
+    if (m_quickRenderThread) {
+        m_quickRenderThread->stop();
+        delete m_quickRenderThread;
+    }
+
+    if (!m_traceFile.isEmpty())
+        m_profiler.writeTrace(m_traceFile);
+
+    qDeleteAll(m_inputQueue);
+    delete m_sceneManager;
+    delete m_tiledRenderer;
     delete m_renderControl;
     delete m_qmlComponent;
     delete m_quickWindow;
     delete m_qmlEngine;
 }
 
+QuickSceneManager *VulkanWindowWithSwQuick::sceneManager()
+{
+    if (!m_sceneManager) {
+        m_sceneManager = new QuickSceneManager(this, QSize(ATLAS_SIZE, ATLAS_SIZE), &m_profiler);
+        connect(m_sceneManager, &QuickSceneManager::changed, this, &QWindow::requestUpdate);
+    }
+    return m_sceneManager;
+}
+
+void VulkanWindowWithSwQuick::setQuickImageFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGB32:
+    case QImage::Format_RGB16:
+    case QImage::Format_ARGB4444_Premultiplied:
+    case QImage::Format_Grayscale8:
+        m_quickImageFormat = format;
+        break;
+    default:
+        qWarning("Unsupported Qt Quick image format %d", int(format));
+        break;
+    }
+}
+
+bool VulkanWindowWithSwQuick::isOpaqueQuick() const
+{
+    return m_opaqueQuick || (m_quickImageFormat != QImage::Format_ARGB32_Premultiplied
+                             && m_quickImageFormat != QImage::Format_ARGB4444_Premultiplied);
+}
+
+void VulkanWindowWithSwQuick::setQuickLodRendering(bool enable)
+{
+    m_quickLodRendering = enable;
+    if (!enable && m_renderScale.scale() < 1) {
+        m_renderScale.reset();
+        if (m_dpr > 0)
+            resizeQuickImage();
+    }
+}
+
+// Keeps the resolution close to what the quad covers on screen, without
+// going below it. An empty size, for a quad partly behind the camera,
+// leaves it alone.
+void VulkanWindowWithSwQuick::updateQuickFootprint(const QSizeF &pixelSize)
+{
+    if (!m_quickLodRendering || m_dpr <= 0 || pixelSize.isEmpty())
+        return;
+
+    const QSizeF full = QSizeF(quickSize()) * m_dpr;
+    const qreal needed = qMax(pixelSize.width() / full.width(), pixelSize.height() / full.height());
+    const qreal oldScale = m_renderScale.scale();
+    if (m_renderScale.update(needed)) {
+        qDebug("Qt Quick render scale %.3f -> %.3f", oldScale, m_renderScale.scale());
+        resizeQuickImage();
+    }
+}
+
+void VulkanWindowWithSwQuick::setQuickSize(const QSize &size)
+{
+    if (m_quickSize == size)
+        return;
+
+    m_quickSize = size;
+    m_followedSize = QSize();
+    if (m_dpr > 0)
+        resizeQuickImage();
+}
+
+// When following the window, this is the window size as of the last
+// debounced resize, which is what the image was created with, not the live
+// one.
+QSize VulkanWindowWithSwQuick::quickSize() const
+{
+    if (!isQuickSizeFollowingWindow())
+        return m_quickSize;
+    return m_followedSize.isEmpty() ? size() : m_followedSize;
+}
+
+void VulkanWindowWithSwQuick::setResizeDebounceInterval(int msecs)
+{
+    m_resizeTimer->setInterval(msecs);
+}
+
+int VulkanWindowWithSwQuick::resizeDebounceInterval() const
+{
+    return m_resizeTimer->interval();
+}
+
+void VulkanWindowWithSwQuick::setTraceFile(const QString &fileName)
+{
+    m_traceFile = fileName;
+    m_profiler.setTraceEnabled(!fileName.isEmpty());
+}
+
+GpuMemoryStats VulkanWindowWithSwQuick::gpuMemoryStats() const
+{
+    return m_renderer ? m_renderer->memoryStats() : GpuMemoryStats();
+}
+
+void VulkanWindowWithSwQuick::setDamageTracking(bool enable)
+{
+    m_damageTracking = enable;
+    requestIncrementalPresent(this, enable);
+}
+
+// In on-demand mode a new frame is only rendered when something asks for
+// it: the Quick scene, input, or whoever changes the 3D state (by calling
+// requestUpdate()). The optional keep-alive timer is a safety net on top.
+void VulkanWindowWithSwQuick::setOnDemandRendering(bool enable)
+{
+    m_onDemand = enable;
+    updateKeepAliveTimer();
+}
+
+void VulkanWindowWithSwQuick::setKeepAliveInterval(int msecs)
+{
+    m_keepAliveInterval = msecs;
+    updateKeepAliveTimer();
+}
+
+void VulkanWindowWithSwQuick::updateKeepAliveTimer()
+{
+    if (m_onDemand && m_keepAliveInterval > 0)
+        m_keepAliveTimer->start(m_keepAliveInterval);
+    else
+        m_keepAliveTimer->stop();
+}
+
+void VulkanWindowWithSwQuick::onQuickSceneChanged()
+{
+    m_quickSceneChanged = true;
+    requestUpdate();
+}
+
 void VulkanWindowWithSwQuick::createQuickImage()
 {
-    if (!m_quickImage.isNull())
+    if (m_dpr > 0)
         return;
 
     m_dpr = devicePixelRatio();
-    m_quickImage = QImage(QSize(QUICK_W, QUICK_H) * m_dpr, QImage::Format_ARGB32_Premultiplied);
-    m_quickImage.setDevicePixelRatio(m_dpr);
+    if (isQuickSizeFollowingWindow() && m_followedSize.isEmpty())
+        m_followedSize = size();
+
+    // In threaded mode the render thread owns the images.
+    if (m_quickRenderThread)
+        return;
+
+    m_quickImage = QImage(quickSize() * quickRenderDpr(), m_quickImageFormat);
+    m_quickImage.setDevicePixelRatio(quickRenderDpr());
+    // Needs rendering even when the scene graph stays the same, and with
+    // only the logical size to go by the renderer may not notice that it
+    // has to paint everything.
+    m_sceneGraphChanged = true;
+    m_quickImageFresh = true;
     qDebug() << "Created" << m_quickImage;
 }
 
@@ -137,22 +375,107 @@ QImage *VulkanWindowWithSwQuick::renderQuickImage(QRegion *dirtyRegion)
 {
     createQuickImage();
 
-    m_renderControl->polishItems();
-    m_renderControl->sync();
+    {
+        ScopedStageTimer t(&m_profiler, FrameProfiler::Polish);
+        m_renderControl->polishItems();
+    }
+    {
+        ScopedStageTimer t(&m_profiler, FrameProfiler::Sync);
+        m_renderControl->sync();
+    }
+    watchSceneGraph();
+
+    // Many bindings fire without any visual effect. When the sync left the
+    // scene graph alone the image is still up to date, and returning null
+    // skips the upload too. The tiled renderers track changes on their own,
+    // the window's renderer stops reporting them once it no longer renders.
+    const bool changed = m_sceneGraphChanged
+            || (m_tiledQuick && (!m_tiledRenderer || m_tiledRenderer->hasChanges()));
+    m_quickSceneChanged = false;
+    if (!changed) {
+        m_profiler.addSkippedRender();
+        return nullptr;
+    }
+    m_sceneGraphChanged = false;
+
+    QRegion flushRegion;
+    if (m_tiledQuick) {
+        if (!m_tiledRenderer)
+            m_tiledRenderer = new TiledQuickRenderer(m_quickWindow);
+        ScopedStageTimer t(&m_profiler, FrameProfiler::Render);
+        flushRegion = m_tiledRenderer->render(&m_quickImage);
+    } else {
+        QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_quickWindow);
+        QSGSoftwareRenderer *r = static_cast<QSGSoftwareRenderer *>(wd->renderer);
+        r->setCurrentPaintDevice(&m_quickImage);
+        if (m_quickImageFresh)
+            r->markDirty();
 
-    QQuickWindowPrivate *wd = QQuickWindowPrivate::get(m_quickWindow);
-    QSGSoftwareRenderer *r = static_cast<QSGSoftwareRenderer *>(wd->renderer);
-    r->setCurrentPaintDevice(&m_quickImage);
+        {
+            ScopedStageTimer t(&m_profiler, FrameProfiler::Render);
+            m_renderControl->render();
+        }
 
-    m_renderControl->render();
+        flushRegion = r->flushRegion();
+    }
+    m_quickImageFresh = false;
+    flushRegion = toImagePixels(flushRegion, m_quickImage);
 
+    if (flushRegion.isEmpty())
+        m_profiler.addWastedRender();
     if (dirtyRegion)
-        *dirtyRegion = r->flushRegion();
+        *dirtyRegion = flushRegion;
 
-    m_quickSceneChanged = false;
     return &m_quickImage;
 }
 
+// The renderer only exists after the first sync, and the scene graph only
+// reports changes through it. The first sync is always treated as a change.
+void VulkanWindowWithSwQuick::watchSceneGraph()
+{
+    QSGRenderer *r = QQuickWindowPrivate::get(m_quickWindow)->renderer;
+    if (r && r != m_watchedRenderer) {
+        m_watchedRenderer = r;
+        connect(r, &QSGAbstractRenderer::sceneGraphChanged, this, &VulkanWindowWithSwQuick::onSceneGraphChanged,
+                Qt::DirectConnection);
+        m_sceneGraphChanged = true;
+    }
+}
+
+void VulkanWindowWithSwQuick::onSceneGraphChanged()
+{
+    m_sceneGraphChanged = true;
+}
+
+// Threaded counterpart of renderQuickImage(): polish happens here and sync
+// happens with the GUI thread blocked, but the raster pass is left to the
+// render thread. Returns false when the previous frame is still in progress.
+bool VulkanWindowWithSwQuick::requestQuickImage()
+{
+    if (m_quickRenderThread->isBusy())
+        return false;
+
+    createQuickImage();
+
+    {
+        ScopedStageTimer t(&m_profiler, FrameProfiler::Polish);
+        m_renderControl->polishItems();
+    }
+
+    if (!m_quickRenderThread->requestFrame(quickSize() * quickRenderDpr(), quickRenderDpr()))
+        return false;
+
+    m_quickSceneChanged = false;
+    return true;
+}
+
+// Returns the most recent image completed by the render thread, or null when
+// there is nothing new since the last call.
+const QImage *VulkanWindowWithSwQuick::takeQuickImage(QRegion *dirtyRegion)
+{
+    return m_quickRenderThread->takeLatestImage(dirtyRegion);
+}
+
 void VulkanWindowWithSwQuick::runQuick()
 {
     disconnect(m_qmlComponent, &QQmlComponent::statusChanged, this, &VulkanWindowWithSwQuick::runQuick);
@@ -183,23 +506,33 @@ void VulkanWindowWithSwQuick::runQuick()
 
     updateQuickSizes();
 
-    m_quickSceneChanged = true;
     m_quickRunning = true;
+    onQuickSceneChanged();
 }
 
 void VulkanWindowWithSwQuick::updateQuickSizes()
 {
     // Behave like SizeRootObjectToView.
-    m_rootItem->setWidth(QUICK_W);
-    m_rootItem->setHeight(QUICK_H);
+    const QSize sz = quickSize();
+    m_rootItem->setWidth(sz.width());
+    m_rootItem->setHeight(sz.height());
 
-    m_quickWindow->setGeometry(0, 0, QUICK_W, QUICK_H);
+    m_quickWindow->setGeometry(0, 0, sz.width(), sz.height());
 }
 
 void VulkanWindowWithSwQuick::startQuick(const QString &filename)
 {
     m_quickStarted = true;
 
+    if (m_threadedQuick) {
+        m_quickRenderThread = new QuickRenderThread(m_renderControl, m_quickWindow, m_quickImageFormat, &m_profiler);
+        // A completed image needs a Vulkan frame to show up, which in
+        // on-demand mode nobody else is going to request.
+        connect(m_quickRenderThread, &QuickRenderThread::frameReady, this, &QWindow::requestUpdate);
+        m_renderControl->prepareThread(m_quickRenderThread);
+        m_quickRenderThread->start();
+    }
+
     m_qmlComponent = new QQmlComponent(m_qmlEngine, QUrl(filename));
     if (m_qmlComponent->isLoading())
         connect(m_qmlComponent, &QQmlComponent::statusChanged, this, &VulkanWindowWithSwQuick::runQuick);
@@ -207,69 +540,404 @@ void VulkanWindowWithSwQuick::startQuick(const QString &filename)
         runQuick();
 }
 
+// The renderer picks up the new image size on the next frame and reuses
+// or replaces its textures as needed, without waiting for the GPU.
 void VulkanWindowWithSwQuick::resizeQuickImage()
 {
     if (m_rootItem) {
         m_quickImage = QImage();
+        m_dpr = 0;
         createQuickImage();
         updateQuickSizes();
+        onQuickSceneChanged();
     }
 }
 
-// Use a static (QUICK_W, QUICK_H) size for now
-//void VulkanWindowWithSwQuick::resizeEvent(QResizeEvent *)
-//{
-//    if (!m_quickImage.isNull() && m_quickImage.size() != size() * devicePixelRatio())
-//        resizeQuickImage();
-//}
+void VulkanWindowWithSwQuick::applyWindowSize()
+{
+    m_followedSize = size();
+    resizeQuickImage();
+}
+
+void VulkanWindowWithSwQuick::resizeEvent(QResizeEvent *)
+{
+    if (isQuickSizeFollowingWindow() && m_dpr > 0 && !size().isEmpty())
+        m_resizeTimer->start();
+}
 
 void VulkanWindowWithSwQuick::onScreenChanged()
 {
-    if (!m_quickImage.isNull() && m_dpr != devicePixelRatio())
+    if (m_dpr > 0 && m_dpr != devicePixelRatio())
         resizeQuickImage();
 }
 
-bool VulkanWindowWithSwQuick::event(QEvent *e)
+// The main scene is drawn with the renderer's mvp, the panels with their
+// own transform on top. Panels that have nothing on screen yet do not count.
+bool VulkanWindowWithSwQuick::quickWindowQuad(QQuickWindow *window, QMatrix4x4 *mvp, QSizeF *size) const
+{
+    if (window == m_quickWindow) {
+        if (!m_quickRunning)
+            return false;
+        *mvp = m_renderer->mvp();
+        *size = m_quickWindow->size();
+        return true;
+    }
+
+    if (m_sceneManager) {
+        for (QuickScene *scene : m_sceneManager->scenes()) {
+            if (scene->quickWindow() == window) {
+                if (!scene->isRunning() || !scene->hasRendered())
+                    return false;
+                *mvp = m_renderer->mvp() * scene->transform();
+                *size = scene->size();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Finds the Quick window whose quad is under pos, in window coordinates, the
+// closest one where quads overlap, and maps pos into its scene. With a grab
+// only the grabbing window is tried, and positions outside of its quad are
+// mapped too, as long as they hit its plane.
+bool VulkanWindowWithSwQuick::pickQuickWindow(const QPointF &pos, QQuickWindow *grab, QQuickWindow **window,
+                                              QPointF *scenePos) const
+{
+    if (!m_renderer)
+        return false;
+
+    QVarLengthArray<QQuickWindow *, 16> candidates;
+    if (grab) {
+        candidates.append(grab);
+    } else {
+        candidates.append(m_quickWindow);
+        if (m_sceneManager) {
+            for (QuickScene *scene : m_sceneManager->scenes())
+                candidates.append(scene->quickWindow());
+        }
+    }
+
+    const QPointF pixelPos = pos * devicePixelRatio();
+    const QSize viewport = swapChainImageSize();
+    float closest = 2;
+    for (QQuickWindow *candidate : candidates) {
+        QMatrix4x4 mvp;
+        QSizeF size;
+        QPointF uv;
+        float distance;
+        if (!quickWindowQuad(candidate, &mvp, &size) || !hitTestQuad(mvp, pixelPos, viewport, &uv, &distance))
+            continue;
+        if ((!grab && !isInsideQuad(uv)) || distance >= closest)
+            continue;
+        closest = distance;
+        *window = candidate;
+        *scenePos = QPointF(uv.x() * size.width(), uv.y() * size.height());
+    }
+    return closest < 2;
+}
+
+// Presses grab the mouse for the Quick window they hit until all buttons
+// are released, like Qt does for windows, so drags keep going to the same
+// scene when they leave its quad.
+bool VulkanWindowWithSwQuick::deliverMouseEvent(QMouseEvent *me)
+{
+    const bool releasesGrab = me->type() == QEvent::MouseButtonRelease && me->buttons() == Qt::NoButton;
+    QQuickWindow *target = nullptr;
+    QPointF scenePos;
+    const bool hit = pickQuickWindow(me->localPos(), m_mouseGrab, &target, &scenePos);
+    if (!m_mouseGrab)
+        setHoverWindow(hit ? target : nullptr);
+
+    if (hit) {
+        if (me->type() == QEvent::MouseButtonPress) {
+            if (!m_mouseGrab)
+                m_mouseGrab = target;
+            setKeyFocusWindow(target);
+        }
+        QMouseEvent mapped(me->type(), scenePos, me->screenPos(), me->button(), me->buttons(), me->modifiers());
+        mapped.setTimestamp(me->timestamp());
+        QCoreApplication::sendEvent(target, &mapped);
+        me->setAccepted(mapped.isAccepted());
+    }
+
+    if (releasesGrab)
+        m_mouseGrab = nullptr;
+    return hit;
+}
+
+// All points of a touch sequence go to the Quick window its first point
+// hit. Points that miss the window's plane keep their window coordinates.
+bool VulkanWindowWithSwQuick::deliverTouchEvent(QTouchEvent *te)
+{
+    if (te->type() == QEvent::TouchBegin) {
+        m_touchGrab = nullptr;
+        QQuickWindow *target = nullptr;
+        QPointF scenePos;
+        if (!te->touchPoints().isEmpty()
+                && pickQuickWindow(te->touchPoints().first().pos(), nullptr, &target, &scenePos)) {
+            m_touchGrab = target;
+            setKeyFocusWindow(target);
+        }
+    }
+
+    QQuickWindow *target = m_touchGrab;
+    if (te->type() == QEvent::TouchEnd || te->type() == QEvent::TouchCancel)
+        m_touchGrab = nullptr;
+    if (!target)
+        return false;
+
+    auto map = [this, target](const QPointF &pos) {
+        QQuickWindow *window;
+        QPointF scenePos;
+        return pickQuickWindow(pos, target, &window, &scenePos) ? scenePos : pos;
+    };
+    QList<QTouchEvent::TouchPoint> points;
+    for (QTouchEvent::TouchPoint tp : te->touchPoints()) {
+        tp.setPos(map(tp.pos()));
+        tp.setScenePos(tp.pos());
+        tp.setStartPos(map(tp.startPos()));
+        tp.setStartScenePos(tp.startPos());
+        tp.setLastPos(map(tp.lastPos()));
+        tp.setLastScenePos(tp.lastPos());
+        points.append(tp);
+    }
+
+    QTouchEvent mapped(te->type(), te->device(), te->modifiers(), te->touchPointStates(), points);
+    mapped.setTimestamp(te->timestamp());
+    QCoreApplication::sendEvent(target, &mapped);
+    te->setAccepted(mapped.isAccepted());
+    return true;
+}
+
+bool VulkanWindowWithSwQuick::deliverWheelEvent(QWheelEvent *we)
+{
+    QQuickWindow *target = nullptr;
+    QPointF scenePos;
+    if (!pickQuickWindow(we->posF(), m_mouseGrab, &target, &scenePos))
+        return false;
+
+    QWheelEvent mapped(scenePos, we->globalPosF(), we->pixelDelta(), we->angleDelta(), we->delta(),
+                       we->orientation(), we->buttons(), we->modifiers(), we->phase(), we->source(),
+                       we->inverted());
+    mapped.setTimestamp(we->timestamp());
+    QCoreApplication::sendEvent(target, &mapped);
+    we->setAccepted(mapped.isAccepted());
+    return true;
+}
+
+// The Quick window only clears its hover state when told that the mouse
+// left it.
+void VulkanWindowWithSwQuick::setHoverWindow(QQuickWindow *window)
+{
+    if (window == m_hoverWindow)
+        return;
+
+    if (m_hoverWindow) {
+        QEvent leave(QEvent::Leave);
+        QCoreApplication::sendEvent(m_hoverWindow, &leave);
+    }
+    m_hoverWindow = window;
+}
+
+QQuickWindow *VulkanWindowWithSwQuick::keyFocusWindow() const
+{
+    if (m_keyFocus)
+        return m_keyFocus;
+    return m_quickRunning ? m_quickWindow : nullptr;
+}
+
+// Keys go to the Quick window that was last clicked or touched, the main
+// scene until then. Only that one has active focus while this window does.
+void VulkanWindowWithSwQuick::setKeyFocusWindow(QQuickWindow *window)
+{
+    QQuickWindow *old = keyFocusWindow();
+    m_keyFocus = window;
+    if (window == old || !isActive())
+        return;
+
+    if (old) {
+        QFocusEvent focusOut(QEvent::FocusOut, Qt::MouseFocusReason);
+        QCoreApplication::sendEvent(old, &focusOut);
+    }
+    QFocusEvent focusIn(QEvent::FocusIn, Qt::MouseFocusReason);
+    QCoreApplication::sendEvent(window, &focusIn);
+}
+
+// Consecutive moves only need the latest position. Touch updates can be
+// merged the same way as long as no point is pressed or released in them.
+static bool replacesQueuedEvent(const QEvent *queued, const QEvent *e)
+{
+    if (queued->type() != e->type())
+        return false;
+    if (e->type() == QEvent::MouseMove)
+        return true;
+    if (e->type() != QEvent::TouchUpdate)
+        return false;
+
+    const QTouchEvent *a = static_cast<const QTouchEvent *>(queued);
+    const QTouchEvent *b = static_cast<const QTouchEvent *>(e);
+    const Qt::TouchPointStates changes = Qt::TouchPointPressed | Qt::TouchPointReleased;
+    if ((a->touchPointStates() & changes) || (b->touchPointStates() & changes)
+            || a->touchPoints().count() != b->touchPoints().count())
+        return false;
+    for (int i = 0; i < a->touchPoints().count(); ++i) {
+        if (a->touchPoints().at(i).id() != b->touchPoints().at(i).id())
+            return false;
+    }
+    return true;
+}
+
+static QEvent *cloneInputEvent(QEvent *e)
+{
+    switch (e->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseMove:
+        return new QMouseEvent(*static_cast<QMouseEvent *>(e));
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+    case QEvent::TouchEnd:
+    case QEvent::TouchCancel:
+        return new QTouchEvent(*static_cast<QTouchEvent *>(e));
+    case QEvent::Wheel:
+        return new QWheelEvent(*static_cast<QWheelEvent *>(e));
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+        return new QKeyEvent(*static_cast<QKeyEvent *>(e));
+    case QEvent::FocusIn:
+    case QEvent::FocusOut:
+        return new QFocusEvent(*static_cast<QFocusEvent *>(e));
+    default:
+        return new QEvent(e->type());
+    }
+}
+
+// Every event delivered may change the scene and so cost a render. Queued
+// events are delivered together once per frame instead, which costs one.
+void VulkanWindowWithSwQuick::queueInputEvent(QEvent *e)
+{
+    if (m_inputQueue.isEmpty())
+        m_oldestInput = m_profiler.now();
+
+    QEvent *copy = cloneInputEvent(e);
+    if (!m_inputQueue.isEmpty() && replacesQueuedEvent(m_inputQueue.last(), copy)) {
+        delete m_inputQueue.last();
+        m_inputQueue.last() = copy;
+    } else {
+        m_inputQueue.append(copy);
+    }
+
+    // Nothing is rendering, the window may not be exposed.
+    if (m_inputQueue.count() >= MAX_QUEUED_INPUT)
+        deliverPendingInput();
+    else
+        requestUpdate();
+}
+
+void VulkanWindowWithSwQuick::deliverInputEvent(QEvent *e)
 {
     switch (e->type()) {
     case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
     case QEvent::MouseMove:
+        deliverMouseEvent(static_cast<QMouseEvent *>(e));
+        break;
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+    case QEvent::TouchEnd:
+    case QEvent::TouchCancel:
+        deliverTouchEvent(static_cast<QTouchEvent *>(e));
+        break;
+    case QEvent::Wheel:
+        deliverWheelEvent(static_cast<QWheelEvent *>(e));
+        break;
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+    case QEvent::FocusIn:
+    case QEvent::FocusOut:
+        if (QQuickWindow *window = keyFocusWindow())
+            QCoreApplication::sendEvent(window, e);
+        break;
+    case QEvent::Leave:
+        if (!m_mouseGrab)
+            setHoverWindow(nullptr);
+        break;
+    default:
+        break;
+    }
+}
+
+void VulkanWindowWithSwQuick::deliverPendingInput()
+{
+    if (m_inputQueue.isEmpty())
+        return;
+
+    // Delivery may trigger new input, via nested event loops for example.
+    const QVector<QEvent *> events = m_inputQueue;
+    m_inputQueue.clear();
+    m_profiler.addInputEvents(events.count(), m_oldestInput);
+
+    for (QEvent *e : events) {
+        deliverInputEvent(e);
+        delete e;
+    }
+}
+
+// Input is queued and handed to the Quick windows in one go right before
+// the next frame's Quick render, see deliverPendingInput(). The events are
+// accepted here already, the Quick windows' verdict only comes later.
+bool VulkanWindowWithSwQuick::event(QEvent *e)
+{
+    switch (e->type()) {
+    case QEvent::MouseButtonPress:
     case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseMove:
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+    case QEvent::TouchEnd:
+    case QEvent::TouchCancel:
+    case QEvent::Wheel:
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
         if (m_quickWindow && m_renderer) {
-            QMouseEvent *me = static_cast<QMouseEvent *>(e);
-            QPointF p = me->localPos();
-
-            // Normally here comes the tricky part with picking, projecting, and
-            // whatnot. Our case in this example is somewhat simple since the
-            // quad's geometry is well-known and there is no rotation around X or Y.
-
-            const QSize sz = swapChainImageSize();
-            QVector3D tlv = QVector3D(-1, 1, 0).project(m_renderer->modelView(), m_renderer->projection(), QRect(QPoint(0, 0), sz));
-            QPointF tl(tlv.x(), tlv.y());
-            QVector3D brv = QVector3D(1, -1, 0).project(m_renderer->modelView(), m_renderer->projection(), QRect(QPoint(0, 0), sz));
-            QPointF br(brv.x(), brv.y());
-
-            if ((p.x() >= tl.x() && p.y() >= tl.y() && p.x() <= br.x() && p.y() <= br.y()) || e->type() == QEvent::MouseButtonRelease) {
-                // got a hit, now normalize
-                p -= tl;
-                p.setX(p.x() / (brv.x() - tlv.x() + 1));
-                p.setY(p.y() / (brv.y() - tlv.y() + 1));
-                // get a position in the Quick scene space
-                p = QPointF(p.x() / devicePixelRatio() * m_quickWindow->width(), p.y() / devicePixelRatio() * m_quickWindow->height());
-                // send
-                QMouseEvent mappedEvent(me->type(), p, me->screenPos(), me->button(), me->buttons(), me->modifiers());
-                QCoreApplication::sendEvent(m_quickWindow, &mappedEvent);
-                me->setAccepted(mappedEvent.isAccepted());
-                return true;
-            }
+            queueInputEvent(e);
+            e->accept();
+            return true;
         }
         break;
+    case QEvent::FocusIn:
+    case QEvent::FocusOut:
+    case QEvent::Leave:
+        if (m_quickWindow && m_renderer)
+            queueInputEvent(e);
+        break;
+    case QEvent::UpdateRequest:
+        // The next frame is already due at its latch time, and whatever
+        // asked for an update makes it in then.
+        if (m_renderer && m_renderer->isWaitingForLatch())
+            return true;
+        break;
     default:
         break;
     }
     return QVulkanWindow::event(e);
 }
 
+// The swapchain is clipped, so whatever was covered holds undefined pixels
+// now. Damage tracking cannot know which, everything gets drawn again.
+void VulkanWindowWithSwQuick::exposeEvent(QExposeEvent *e)
+{
+    QVulkanWindow::exposeEvent(e);
+    if (m_renderer && isExposed()) {
+        m_renderer->invalidateSwapChainContents();
+        requestUpdate();
+    }
+}
+
 QVulkanWindowRenderer *VulkanWindowWithSwQuick::createRenderer()
 {
     m_renderer = new VulkanRenderer(this);
@@ -282,8 +950,23 @@ VulkanRenderer::VulkanRenderer(VulkanWindowWithSwQuick *w)
     for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i) {
         m_texImage[i] = VK_NULL_HANDLE;
         m_texView[i] = VK_NULL_HANDLE;
+        m_texLayout[i] = VK_IMAGE_LAYOUT_UNDEFINED;
+        m_texSerial[i] = 0;
+        m_stagingBuf[i] = VK_NULL_HANDLE;
+        memset(&m_uploadRing[i], 0, sizeof(UploadBuffer));
+        memset(&m_panelUpload[i], 0, sizeof(UploadBuffer));
+        m_timestampFrame[i] = 0;
         m_descDirty[i] = false;
+        m_frameFence[i] = VK_NULL_HANDLE;
+        m_frameFencePending[i] = false;
     }
+    for (int i = 0; i < QVulkanWindow::MAX_SWAPCHAIN_BUFFER_COUNT; ++i)
+        m_swapImageFrame[i] = 0;
+    memset(&m_renderAreaGranularity, 0, sizeof(m_renderAreaGranularity));
+
+    m_latchTimer.setSingleShot(true);
+    m_latchTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&m_latchTimer, &QTimer::timeout, m_window, &QWindow::requestUpdate);
 }
 
 void VulkanRenderer::initResources()
@@ -294,6 +977,81 @@ void VulkanRenderer::initResources()
     m_devFuncs = m_window->vulkanInstance()->deviceFunctions(dev);
 
     const int concurrentFrameCount = m_window->concurrentFrameCount();
+    QVulkanFunctions *f = m_window->vulkanInstance()->functions();
+
+    // Host visible memory stays mapped, writes to it have to be flushed
+    // explicitly when the memory type is not coherent.
+    VkPhysicalDeviceMemoryProperties memProps;
+    f->vkGetPhysicalDeviceMemoryProperties(m_window->physicalDevice(), &memProps);
+    m_memory.create(m_devFuncs, dev, memProps, m_window->physicalDeviceProperties()->limits);
+    m_nonCoherentAtomSize = qMax<VkDeviceSize>(1, m_window->physicalDeviceProperties()->limits.nonCoherentAtomSize);
+
+    m_texFormat = textureFormat(m_window->quickImageFormat(), &m_texBpp);
+
+    // Sampling straight from linear host memory is convenient but is not
+    // necessarily supported, and is slow on discrete GPUs. Go via a staging
+    // buffer and optimal tiling in these cases.
+    switch (m_window->textureUpload()) {
+    case VulkanWindowWithSwQuick::LinearTextureUpload:
+        m_uploadMode = LinearUpload;
+        break;
+    case VulkanWindowWithSwQuick::StagingTextureUpload:
+        m_uploadMode = StagingUpload;
+        break;
+    case VulkanWindowWithSwQuick::SharedTextureUpload:
+        m_uploadMode = SharedUpload;
+        break;
+    case VulkanWindowWithSwQuick::CompressedTextureUpload:
+    {
+        // QVulkanWindow enables all supported features, BC included.
+        VkPhysicalDeviceFeatures features;
+        f->vkGetPhysicalDeviceFeatures(m_window->physicalDevice(), &features);
+        VkFormatProperties props;
+        f->vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), VK_FORMAT_BC3_UNORM_BLOCK, &props);
+        const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+                | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (m_texBpp != 4) {
+            qWarning("Compressed upload needs a 32-bit Qt Quick image, using shared upload instead");
+            m_uploadMode = SharedUpload;
+        } else if (features.textureCompressionBC && (props.optimalTilingFeatures & needed) == needed) {
+            m_uploadMode = CompressedUpload;
+        } else {
+            qWarning("BC3 textures are not supported, using shared upload instead");
+            m_uploadMode = SharedUpload;
+        }
+    }
+        break;
+    default:
+    {
+        VkFormatProperties props;
+        f->vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), m_texFormat, &props);
+        const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+                | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        const bool canSampleLinear = (props.linearTilingFeatures & needed) == needed;
+        const bool discrete = m_window->physicalDeviceProperties()->deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+        m_uploadMode = canSampleLinear && !discrete ? LinearUpload : StagingUpload;
+    }
+        break;
+    }
+    // Mipmaps are blitted on the GPU, which needs optimal images that are
+    // written with transfers.
+    if (m_window->hasQuickMipmaps()) {
+        VkFormatProperties props;
+        f->vkGetPhysicalDeviceFormatProperties(m_window->physicalDevice(), m_texFormat, &props);
+        const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+                | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (m_uploadMode != StagingUpload && m_uploadMode != SharedUpload)
+            qWarning("Mipmaps need staging or shared upload, disabling them");
+        else if ((props.optimalTilingFeatures & needed) != needed)
+            qWarning("Mipmaps are not supported for this texture format, disabling them");
+        else
+            m_mipmaps = true;
+    }
+
+    static const char *uploadModeNames[] = { "linear", "staging", "shared", "compressed" };
+    qDebug("Texture upload mode: %s, %d bytes per pixel%s, copy kernel: %s, BC encoder: %s",
+           uploadModeNames[m_uploadMode], m_texBpp, m_window->isOpaqueQuick() ? ", opaque" : "",
+           rectCopyKernelName(), bcEncoderKernelName());
 
     VkSamplerCreateInfo samplerInfo;
     memset(&samplerInfo, 0, sizeof(samplerInfo));
@@ -303,43 +1061,82 @@ void VulkanRenderer::initResources()
     samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
     samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    if (m_mipmaps) {
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    }
+    // QVulkanWindow enables all supported features, anisotropy included.
+    if (m_window->quickMaxAnisotropy() > 1) {
+        VkPhysicalDeviceFeatures features;
+        f->vkGetPhysicalDeviceFeatures(m_window->physicalDevice(), &features);
+        if (features.samplerAnisotropy) {
+            samplerInfo.anisotropyEnable = VK_TRUE;
+            samplerInfo.maxAnisotropy = qMin(m_window->quickMaxAnisotropy(),
+                                             m_window->physicalDeviceProperties()->limits.maxSamplerAnisotropy);
+            qDebug("Anisotropic filtering up to %.0fx", samplerInfo.maxAnisotropy);
+        } else {
+            qWarning("Anisotropic filtering is not supported");
+        }
+    }
     VkResult err = m_devFuncs->vkCreateSampler(dev, &samplerInfo, nullptr, &m_sampler);
     if (err != VK_SUCCESS)
         qFatal("Failed to create sampler: %d", err);
 
-    VkBufferCreateInfo bufInfo;
-    memset(&bufInfo, 0, sizeof(bufInfo));
-    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufInfo.size = sizeof(vertexData);
-    bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_vertexBuf);
-    if (err != VK_SUCCESS)
+    // GPU timings are optional, not all queues support timestamps.
+    const VkPhysicalDeviceLimits &limits(m_window->physicalDeviceProperties()->limits);
+    if (limits.timestampComputeAndGraphics) {
+        VkQueryPoolCreateInfo queryPoolInfo;
+        memset(&queryPoolInfo, 0, sizeof(queryPoolInfo));
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = 2 * concurrentFrameCount;
+        err = m_devFuncs->vkCreateQueryPool(dev, &queryPoolInfo, nullptr, &m_timestampPool);
+        if (err != VK_SUCCESS)
+            qWarning("Failed to create timestamp query pool: %d", err);
+        m_timestampPeriod = limits.timestampPeriod;
+    }
+
+    VkFenceCreateInfo fenceInfo;
+    memset(&fenceInfo, 0, sizeof(fenceInfo));
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i) {
+        err = m_devFuncs->vkCreateFence(dev, &fenceInfo, nullptr, &m_frameFence[i]);
+        if (err != VK_SUCCESS)
+            qFatal("Failed to create fence: %d", err);
+    }
+
+    if (m_window->isDamageTracking() && !createPartialRenderPass())
+        qWarning("Damage tracking only covers the present, every frame is redrawn in full");
+
+    VkBufferCreateInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(bufInfo));
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    m_oneVertexBufSize = aligned(sizeof(vertexData), m_nonCoherentAtomSize);
+    // The extra copy at the end is the unscaled quad for the panels.
+    bufInfo.size = m_oneVertexBufSize * (concurrentFrameCount + 1);
+    bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_vertexBuf);
+    if (err != VK_SUCCESS)
         qFatal("Failed to create buffer: %d", err);
 
     VkMemoryRequirements memReq;
     m_devFuncs->vkGetBufferMemoryRequirements(dev, m_vertexBuf, &memReq);
 
-    VkMemoryAllocateInfo memAllocInfo = {
-        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        nullptr,
-        memReq.size,
-        m_window->hostVisibleMemoryIndex()
-    };
-
-    err = m_devFuncs->vkAllocateMemory(dev, &memAllocInfo, nullptr, &m_vertexBufMem);
-    if (err != VK_SUCCESS)
-        qFatal("Failed to allocate memory: %d", err);
+    // Stays mapped, the texture coordinates change when the content size
+    // does.
+    if (!m_memory.allocate(memReq, m_window->hostVisibleMemoryIndex(), GpuMemoryAllocator::LinearResource,
+                           &m_vertexBufMem))
+        qFatal("Failed to allocate memory for the vertex buffer");
 
-    err = m_devFuncs->vkBindBufferMemory(dev, m_vertexBuf, m_vertexBufMem, 0);
+    err = m_devFuncs->vkBindBufferMemory(dev, m_vertexBuf, m_vertexBufMem.memory, m_vertexBufMem.offset);
     if (err != VK_SUCCESS)
         qFatal("Failed to bind buffer memory: %d", err);
 
-    quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_vertexBufMem, 0, memReq.size, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        qFatal("Failed to map memory: %d", err);
-    memcpy(p, vertexData, sizeof(vertexData));
-    m_devFuncs->vkUnmapMemory(dev, m_vertexBufMem);
+    for (int i = 0; i < concurrentFrameCount; ++i) {
+        m_vertexUvScale[i] = QSizeF(1, 1);
+        writeVertexData(i, m_vertexUvScale[i]);
+    }
+    writeVertexData(concurrentFrameCount, QSizeF(1, 1));
 
     // Pipeline.
     VkVertexInputBindingDescription vertexBindingDesc = {
@@ -371,40 +1168,51 @@ void VulkanRenderer::initResources()
     vertexInputInfo.vertexAttributeDescriptionCount = 2;
     vertexInputInfo.pVertexAttributeDescriptions = vertexAttrDesc;
 
+    // Seed the cache with what the previous run left behind, if anything.
+    const QByteArray pipelineCacheData = loadPipelineCacheData();
     VkPipelineCacheCreateInfo pipelineCacheInfo;
     memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
     pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheInfo.initialDataSize = size_t(pipelineCacheData.size());
+    pipelineCacheInfo.pInitialData = pipelineCacheData.constData();
     err = m_devFuncs->vkCreatePipelineCache(dev, &pipelineCacheInfo, nullptr, &m_pipelineCache);
     if (err != VK_SUCCESS)
         qFatal("Failed to create pipeline cache: %d", err);
 
+    // One set per frame, plus one for the panel atlas. In compressed mode
+    // the sets have the compressed, hot and indirection images.
+    const uint32_t bindingCount = m_uploadMode == CompressedUpload ? 3 : 1;
     VkDescriptorPoolSize descPoolSizes = {
-        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(concurrentFrameCount)
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(concurrentFrameCount + 1) * bindingCount
     };
     VkDescriptorPoolCreateInfo descPoolInfo;
     memset(&descPoolInfo, 0, sizeof(descPoolInfo));
     descPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descPoolInfo.maxSets = concurrentFrameCount;
+    // The panel atlas set is freed on its own with the panel resources.
+    descPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descPoolInfo.maxSets = concurrentFrameCount + 1;
     descPoolInfo.poolSizeCount = 1;
     descPoolInfo.pPoolSizes = &descPoolSizes;
     err = m_devFuncs->vkCreateDescriptorPool(dev, &descPoolInfo, nullptr, &m_descPool);
     if (err != VK_SUCCESS)
         qFatal("Failed to create descriptor pool: %d", err);
 
-    VkDescriptorSetLayoutBinding layoutBinding = {
-        0, // binding
-        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-        1, // descriptorCount
-        VK_SHADER_STAGE_FRAGMENT_BIT,
-        nullptr
-    };
+    // The panels only use the first binding.
+    VkDescriptorSetLayoutBinding layoutBindings[3];
+    for (uint32_t i = 0; i < bindingCount; ++i) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        layoutBindings[i].pImmutableSamplers = nullptr;
+    }
 
     VkDescriptorSetLayoutCreateInfo descLayoutInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
         nullptr,
         0,
-        1, // bindingCount
-        &layoutBinding
+        bindingCount,
+        layoutBindings
     };
     err = m_devFuncs->vkCreateDescriptorSetLayout(dev, &descLayoutInfo, nullptr, &m_descSetLayout);
     if (err != VK_SUCCESS)
@@ -442,6 +1250,8 @@ void VulkanRenderer::initResources()
 
     VkShaderModule vertShaderModule = createShader(QStringLiteral(":/texture_vert.spv"));
     VkShaderModule fragShaderModule = createShader(QStringLiteral(":/texture_frag.spv"));
+    VkShaderModule tiledFragShaderModule = m_uploadMode == CompressedUpload
+            ? createShader(QStringLiteral(":/tiled_frag.spv")) : VK_NULL_HANDLE;
 
     VkGraphicsPipelineCreateInfo pipelineInfo;
     memset(&pipelineInfo, 0, sizeof(pipelineInfo));
@@ -462,7 +1272,7 @@ void VulkanRenderer::initResources()
             nullptr,
             0,
             VK_SHADER_STAGE_FRAGMENT_BIT,
-            fragShaderModule,
+            tiledFragShaderModule ? tiledFragShaderModule : fragShaderModule,
             "main",
             nullptr
         }
@@ -513,11 +1323,12 @@ void VulkanRenderer::initResources()
     VkPipelineColorBlendStateCreateInfo cb;
     memset(&cb, 0, sizeof(cb));
     cb.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    // assume pre-multiplied alpha, blend, write out all of rgba
+    // assume pre-multiplied alpha, blend, write out all of rgba. Opaque
+    // scenes skip the blending.
     VkPipelineColorBlendAttachmentState att;
     memset(&att, 0, sizeof(att));
     att.colorWriteMask = 0xF;
-    att.blendEnable = VK_TRUE;
+    att.blendEnable = m_window->isOpaqueQuick() ? VK_FALSE : VK_TRUE;
     att.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
     att.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
     att.colorBlendOp = VK_BLEND_OP_ADD;
@@ -543,10 +1354,55 @@ void VulkanRenderer::initResources()
     if (err != VK_SUCCESS)
         qFatal("Failed to create graphics pipeline: %d", err);
 
+    // The panels use the same state, but take their MVP and atlas rect from
+    // a second, per-instance vertex buffer.
+    VkShaderModule panelVertShaderModule = createShader(QStringLiteral(":/panel_vert.spv"));
+    shaderStages[0].module = panelVertShaderModule;
+    shaderStages[1].module = fragShaderModule;
+
+    VkVertexInputBindingDescription panelBindingDesc[2] = {
+        vertexBindingDesc,
+        {
+            1, // binding
+            uint32_t(PANEL_INSTANCE_SIZE),
+            VK_VERTEX_INPUT_RATE_INSTANCE
+        }
+    };
+    VkVertexInputAttributeDescription panelAttrDesc[7] = {
+        vertexAttrDesc[0],
+        vertexAttrDesc[1]
+    };
+    // mat4 mvp takes four locations, followed by the uv rect.
+    for (uint32_t i = 0; i < 5; ++i) {
+        panelAttrDesc[2 + i].location = 2 + i;
+        panelAttrDesc[2 + i].binding = 1;
+        panelAttrDesc[2 + i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        panelAttrDesc[2 + i].offset = i * 4 * sizeof(float);
+    }
+
+    VkPipelineVertexInputStateCreateInfo panelVertexInputInfo = vertexInputInfo;
+    panelVertexInputInfo.vertexBindingDescriptionCount = 2;
+    panelVertexInputInfo.pVertexBindingDescriptions = panelBindingDesc;
+    panelVertexInputInfo.vertexAttributeDescriptionCount = 7;
+    panelVertexInputInfo.pVertexAttributeDescriptions = panelAttrDesc;
+    pipelineInfo.pVertexInputState = &panelVertexInputInfo;
+
+    // Panels are visible from both sides, and always blend.
+    rs.cullMode = VK_CULL_MODE_NONE;
+    att.blendEnable = VK_TRUE;
+
+    err = m_devFuncs->vkCreateGraphicsPipelines(dev, m_pipelineCache, 1, &pipelineInfo, nullptr, &m_panelPipeline);
+    if (err != VK_SUCCESS)
+        qFatal("Failed to create panel pipeline: %d", err);
+
     if (vertShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, vertShaderModule, nullptr);
+    if (panelVertShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, panelVertShaderModule, nullptr);
     if (fragShaderModule)
         m_devFuncs->vkDestroyShaderModule(dev, fragShaderModule, nullptr);
+    if (tiledFragShaderModule)
+        m_devFuncs->vkDestroyShaderModule(dev, tiledFragShaderModule, nullptr);
 }
 
 void VulkanRenderer::initSwapChainResources()
@@ -561,11 +1417,22 @@ void VulkanRenderer::initSwapChainResources()
     m_modelView.translate(0, 0, -4);
 
     m_mvp = m_projection * m_modelView;
+
+    // The new swapchain images have never been drawn to.
+    invalidateSwapChainContents();
+    m_incrementalPresent = m_window->isDamageTracking() && hookIncrementalPresent(m_window);
+    if (m_window->isDamageTracking())
+        qDebug("incremental present %s", m_incrementalPresent ? "enabled" : "not supported");
 }
 
 void VulkanRenderer::releaseSwapChainResources()
 {
     qDebug("releaseSwapChainResources");
+
+    if (m_incrementalPresent) {
+        unhookIncrementalPresent(m_window);
+        m_incrementalPresent = false;
+    }
 }
 
 void VulkanRenderer::releaseResources()
@@ -573,6 +1440,8 @@ void VulkanRenderer::releaseResources()
     qDebug("releaseResources");
 
     releaseTex();
+    releaseUploadRing();
+    releasePanelResources();
 
     VkDevice dev = m_window->device();
 
@@ -581,6 +1450,26 @@ void VulkanRenderer::releaseResources()
         m_sampler = VK_NULL_HANDLE;
     }
 
+    if (m_timestampPool) {
+        m_devFuncs->vkDestroyQueryPool(dev, m_timestampPool, nullptr);
+        m_timestampPool = VK_NULL_HANDLE;
+        for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i)
+            m_timestampFrame[i] = 0;
+    }
+
+    for (int i = 0; i < QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT; ++i) {
+        if (m_frameFence[i]) {
+            m_devFuncs->vkDestroyFence(dev, m_frameFence[i], nullptr);
+            m_frameFence[i] = VK_NULL_HANDLE;
+        }
+        m_frameFencePending[i] = false;
+    }
+
+    if (m_partialRenderPass) {
+        m_devFuncs->vkDestroyRenderPass(dev, m_partialRenderPass, nullptr);
+        m_partialRenderPass = VK_NULL_HANDLE;
+    }
+
     if (m_descSetLayout) {
         m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_descSetLayout, nullptr);
         m_descSetLayout = VK_NULL_HANDLE;
@@ -596,12 +1485,18 @@ void VulkanRenderer::releaseResources()
         m_pipeline = VK_NULL_HANDLE;
     }
 
+    if (m_panelPipeline) {
+        m_devFuncs->vkDestroyPipeline(dev, m_panelPipeline, nullptr);
+        m_panelPipeline = VK_NULL_HANDLE;
+    }
+
     if (m_pipelineLayout) {
         m_devFuncs->vkDestroyPipelineLayout(dev, m_pipelineLayout, nullptr);
         m_pipelineLayout = VK_NULL_HANDLE;
     }
 
     if (m_pipelineCache) {
+        savePipelineCache();
         m_devFuncs->vkDestroyPipelineCache(dev, m_pipelineCache, nullptr);
         m_pipelineCache = VK_NULL_HANDLE;
     }
@@ -611,34 +1506,229 @@ void VulkanRenderer::releaseResources()
         m_vertexBuf = VK_NULL_HANDLE;
     }
 
-    if (m_vertexBufMem) {
-        m_devFuncs->vkFreeMemory(dev, m_vertexBufMem, nullptr);
-        m_vertexBufMem = VK_NULL_HANDLE;
-    }
+    m_memory.free(&m_vertexBufMem);
+    m_memory.destroy();
 }
 
 void VulkanRenderer::releaseTex()
 {
-    VkDevice dev = m_window->device();
+    retireTex();
+    releaseDeferred(true);
+}
 
+// Detaches the current images from the renderer and queues them for
+// destruction, since frames still in flight may be sampling them.
+void VulkanRenderer::retireTex()
+{
     for (int i = 0; i < m_window->concurrentFrameCount(); ++i) {
         if (m_texView[i]) {
-            m_devFuncs->vkDestroyImageView(dev, m_texView[i], nullptr);
+            releaseImageViewLater(m_texView[i]);
             m_texView[i] = VK_NULL_HANDLE;
         }
-
         if (m_texImage[i]) {
-            m_devFuncs->vkDestroyImage(dev, m_texImage[i], nullptr);
+            releaseImageLater(m_texImage[i]);
             m_texImage[i] = VK_NULL_HANDLE;
         }
+        if (m_stagingBuf[i]) {
+            releaseBufferLater(m_stagingBuf[i]);
+            m_stagingBuf[i] = VK_NULL_HANDLE;
+        }
     }
 
-    if (m_texMem) {
-        m_devFuncs->vkFreeMemory(dev, m_texMem, nullptr);
-        m_texMem = VK_NULL_HANDLE;
+    releaseMemoryLater(&m_texMem);
+    releaseMemoryLater(&m_stagingMem);
+
+    VkImageView views[] = { m_hotView, m_tileView };
+    VkImage images[] = { m_hotImage, m_tileImage };
+    for (int i = 0; i < 2; ++i) {
+        if (views[i])
+            releaseImageViewLater(views[i]);
+        if (images[i])
+            releaseImageLater(images[i]);
     }
+    releaseMemoryLater(&m_hotMem);
+    releaseMemoryLater(&m_tileMem);
+    m_hotView = m_tileView = VK_NULL_HANDLE;
+    m_hotImage = m_tileImage = VK_NULL_HANDLE;
 
     m_texSize = QSize();
+    m_contentSize = QSize();
+}
+
+void VulkanRenderer::releaseImageLater(VkImage image)
+{
+    DeferredRelease r;
+    memset(&r, 0, sizeof(r));
+    r.type = DeferredRelease::Image;
+    r.frame = m_frameCount;
+    r.image = image;
+    m_deferredReleases.append(r);
+}
+
+void VulkanRenderer::releaseImageViewLater(VkImageView view)
+{
+    DeferredRelease r;
+    memset(&r, 0, sizeof(r));
+    r.type = DeferredRelease::ImageView;
+    r.frame = m_frameCount;
+    r.imageView = view;
+    m_deferredReleases.append(r);
+}
+
+void VulkanRenderer::releaseBufferLater(VkBuffer buffer)
+{
+    DeferredRelease r;
+    memset(&r, 0, sizeof(r));
+    r.type = DeferredRelease::Buffer;
+    r.frame = m_frameCount;
+    r.buffer = buffer;
+    m_deferredReleases.append(r);
+}
+
+// Takes over the allocation and resets it to null.
+void VulkanRenderer::releaseMemoryLater(GpuAllocation *mem)
+{
+    if (!mem->memory)
+        return;
+
+    DeferredRelease r;
+    memset(&r, 0, sizeof(r));
+    r.type = DeferredRelease::Memory;
+    r.frame = m_frameCount;
+    r.memory = *mem;
+    m_deferredReleases.append(r);
+    memset(mem, 0, sizeof(GpuAllocation));
+}
+
+// Called at the start of each frame, or with all set when the device is known
+// to be idle. Once concurrentFrameCount frames have been started after the
+// one a resource was released in, QVulkanWindow has waited for the fence of
+// that frame's slot, so the GPU is done with it. Entries are in release
+// order, with dependent objects (views) queued before what they refer to.
+void VulkanRenderer::releaseDeferred(bool all)
+{
+    VkDevice dev = m_window->device();
+    const quint64 framesInFlight = quint64(m_window->concurrentFrameCount());
+
+    int done = 0;
+    for (DeferredRelease &r : m_deferredReleases) {
+        if (!all && m_frameCount - r.frame < framesInFlight)
+            break;
+
+        switch (r.type) {
+        case DeferredRelease::Image:
+            m_devFuncs->vkDestroyImage(dev, r.image, nullptr);
+            break;
+        case DeferredRelease::ImageView:
+            m_devFuncs->vkDestroyImageView(dev, r.imageView, nullptr);
+            break;
+        case DeferredRelease::Buffer:
+            m_devFuncs->vkDestroyBuffer(dev, r.buffer, nullptr);
+            break;
+        case DeferredRelease::Memory:
+            m_memory.free(&r.memory);
+            break;
+        }
+        ++done;
+    }
+
+    if (done)
+        m_deferredReleases.remove(0, done);
+}
+
+// Fixed size scenes get exactly what they need. When following the window,
+// leave some room so that the textures survive small resizes, except with
+// mipmaps, where the unused area would bleed into the smaller levels.
+// Compressed textures are made of whole tiles, and rows of 8 and 16-bit
+// textures are kept at a multiple of 4 bytes for the staging copies.
+QSize VulkanRenderer::textureCapacity(const QSize &size) const
+{
+    if (m_uploadMode == CompressedUpload && !m_window->isQuickSizeFollowingWindow())
+        return QSize(int(aligned(size.width(), TileCache::TILE_SIZE)),
+                     int(aligned(size.height(), TileCache::TILE_SIZE)));
+
+    if (!m_window->isQuickSizeFollowingWindow() || m_mipmaps)
+        return QSize(int(aligned(size.width(), 4)), size.height());
+
+    return QSize(int(aligned(size.width() + size.width() / 8, 64)),
+                 int(aligned(size.height() + size.height() / 8, 64)));
+}
+
+// Maps the texture coordinates to the part of the images that holds the
+// content. Stops half a texel short of the unused area so that linear
+// filtering does not pick up its garbage.
+void VulkanRenderer::writeVertexData(int slot, const QSizeF &scale)
+{
+    float *p = reinterpret_cast<float *>(m_vertexBufMem.ptr + slot * m_oneVertexBufSize);
+    memcpy(p, vertexData, sizeof(vertexData));
+    for (int v = 0; v < 4; ++v) {
+        p[v * 5 + 3] *= scale.width();
+        p[v * 5 + 4] *= scale.height();
+    }
+
+    m_memory.flush(m_vertexBufMem, slot * m_oneVertexBufSize, m_oneVertexBufSize);
+}
+
+bool VulkanRenderer::createTex(const QSize &size)
+{
+    const int concurrentFrameCount = m_window->concurrentFrameCount();
+
+    // A single device local image, the per-frame staging is separate.
+    const int imageCount = textureIndex(concurrentFrameCount - 1) + 1;
+    const VkFormat format = m_uploadMode == CompressedUpload ? VK_FORMAT_BC3_UNORM_BLOCK : m_texFormat;
+    m_texMipLevels = 1;
+    if (m_mipmaps) {
+        for (int dim = qMax(size.width(), size.height()); dim > 1; dim /= 2)
+            ++m_texMipLevels;
+    }
+
+    if (m_uploadMode == SharedUpload || m_uploadMode == CompressedUpload) {
+        if (!createTextureImage(imageCount, size, format, m_texImage, &m_texMem,
+                                VK_IMAGE_TILING_OPTIMAL,
+                                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                m_window->deviceLocalMemoryIndex()))
+        {
+            qWarning("Failed to create texture");
+            return false;
+        }
+    } else if (m_uploadMode == StagingUpload) {
+        if (!createTextureImage(concurrentFrameCount, size, format, m_texImage, &m_texMem,
+                                VK_IMAGE_TILING_OPTIMAL,
+                                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                m_window->deviceLocalMemoryIndex())
+                || !createStagingBuffers(concurrentFrameCount, size))
+        {
+            qWarning("Failed to create texture");
+            return false;
+        }
+    } else {
+        if (!createTextureImage(concurrentFrameCount, size, format, m_texImage, &m_texMem,
+                                VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT,
+                                m_window->hostVisibleMemoryIndex()))
+        {
+            qWarning("Failed to create texture");
+            return false;
+        }
+    }
+
+    for (int i = 0; i < imageCount; ++i) {
+        if (!createTextureImageView(m_texImage[i], format, &m_texView[i])) {
+            qWarning("Failed to create image view");
+            return false;
+        }
+    }
+
+    if (m_uploadMode == CompressedUpload && !createTileImages(size))
+        return false;
+
+    for (int i = 0; i < concurrentFrameCount; ++i) {
+        m_descDirty[i] = true;
+        // The new images have undefined contents.
+        m_texSerial[i] = 0;
+    }
+
+    m_texSize = size;
+    return true;
 }
 
 void VulkanRenderer::startNextFrame()
@@ -649,79 +1739,162 @@ void VulkanRenderer::startNextFrame()
     if (!m_window->isQuickStarted())
         m_window->startQuick(QStringLiteral("qrc:/rotatingsquare.qml"));
 
+    ++m_frameCount;
+    waitForFramesInFlight();
+    FrameProfiler *profiler = m_window->profiler();
+    profiler->beginFrame(m_frameCount);
+    const qint64 latched = profiler->now();
+    const bool late = m_latchTarget >= 0 ? m_pacer.beginLatchedFrame(latched, m_latchTarget)
+                                         : m_pacer.beginFrame(latched);
+    if (late)
+        profiler->addLateFrame();
+    profiler->addLatch(m_latchTarget >= 0 ? m_latchArmed : latched, latched);
+    m_latchTarget = -1;
+    m_latchTimer.stop();
+
+    // All input since the last frame, before the Quick scenes are updated.
+    // It is picked against the quads as they were last drawn.
+    m_window->deliverPendingInput();
+
+    // Lets the window pick the resolution for the next Quick render.
+    if (m_window->isQuickLodRendering())
+        m_window->updateQuickFootprint(quadFootprint(m_mvp));
+
     // When the (potentially async) init is done, and there was a change in the
     // scene (due to animations f.ex.), then polish, sync and render into the QImage.
-    if (m_window->isQuickRunning() && m_window->hasQuickSceneChanged()) {
-        const int concurrentFrameCount = m_window->concurrentFrameCount();
-        QRegion dirtyRegion;
-        m_source = m_window->renderQuickImage(&dirtyRegion);
-        for (int i = 0; i < concurrentFrameCount; ++i)
-            m_texDirty[i] += dirtyRegion;
-
-        if (!m_source->isNull()) {
-            if (m_texSize != m_source->size()) {
-                // Keep it simple for now... just block, in order to avoid
-                // touching the potentially still-in-use image, descriptors,
-                // etc. This is infrequent anyways.
-                m_devFuncs->vkDeviceWaitIdle(dev);
-
-                releaseTex();
-                // Let's assume sampling from linear tiling is supported.
-                if (!createTextureImage(concurrentFrameCount, m_source->size(), m_texImage, &m_texMem,
-                                        VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT,
-                                        m_window->hostVisibleMemoryIndex()))
-                {
-                    qWarning("Failed to create texture");
-                    return;
-                }
-                for (int i = 0; i < concurrentFrameCount; ++i) {
-                    if (!createTextureImageView(m_texImage[i], &m_texView[i])) {
-                        qWarning("Failed to create image view");
-                        return;
-                    }
-                    m_descDirty[i] = true;
-                }
-                m_texSize = m_source->size();
-            }
+    // In threaded mode the render thread does the rendering instead, and we
+    // just pick up whatever it completed last.
+    const QImage *newSource = nullptr;
+    QRegion dirtyRegion;
+    if (m_window->isQuickRunning()) {
+        if (m_window->isThreadedQuickRendering()) {
+            if (m_window->hasQuickSceneChanged())
+                m_window->requestQuickImage();
+            newSource = m_window->takeQuickImage(&dirtyRegion);
+        } else if (m_window->hasQuickSceneChanged()) {
+            newSource = m_window->renderQuickImage(&dirtyRegion);
         }
     }
 
     // Keep a per-concurrent-frame image+memory(+descriptor set) in order to
     // avoid potentially disturbing the previous, in-flight frame(s).
     int frame = m_window->currentFrame();
-    if (m_descDirty[frame]) {
+
+    releaseDeferred(false);
+
+    if (newSource) {
+        for (const QRect &r : dirtyRegion)
+            profiler->addDirtyPixels(qint64(r.width()) * r.height());
+
+        m_source = newSource;
+        ++m_sourceSerial;
+        m_dirtyHistory[m_sourceSerial % DIRTY_HISTORY_SIZE] = dirtyRegion;
+    }
+
+    // Checked on every frame, not just for a new source, so that a failed
+    // allocation is tried again on the next one.
+    if (m_source && !m_source->isNull() && m_contentSize != m_source->size()) {
+        // Reuse the images when the new size fits and does not waste
+        // more than half of them. Otherwise replace them, the old ones
+        // go away once the frames in flight are done with them.
+        const QSize sz = m_source->size();
+        const bool fits = sz.width() <= m_texSize.width() && sz.height() <= m_texSize.height();
+        const bool wasteful = 2 * sz.width() * sz.height() < m_texSize.width() * m_texSize.height();
+        const bool exact = !m_mipmaps || textureCapacity(sz) == m_texSize;
+        if (!fits || wasteful || !exact) {
+            // On failure the frame is still recorded, just without the
+            // Quick content, so that the window does not stall.
+            retireTex();
+            if (createTex(textureCapacity(sz)))
+                m_contentSize = sz;
+        } else {
+            for (int i = 0; i < m_window->concurrentFrameCount(); ++i)
+                m_texSerial[i] = 0;
+            m_contentSize = sz;
+        }
+    }
+    const int tex = textureIndex(frame);
+    const bool hasTex = m_source && m_texView[tex] != VK_NULL_HANDLE;
+
+    if (hasTex && m_descDirty[frame]) {
         m_descDirty[frame] = false;
+        const VkImageLayout layout = m_uploadMode == LinearUpload ? VK_IMAGE_LAYOUT_GENERAL
+                                                                  : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        VkDescriptorImageInfo descImageInfo[3] = {
+            { m_sampler, m_texView[textureIndex(frame)], layout },
+            { m_sampler, m_hotView, layout },
+            { m_sampler, m_tileView, layout }
+        };
         VkWriteDescriptorSet descWrite;
         memset(&descWrite, 0, sizeof(descWrite));
-        VkDescriptorImageInfo descImageInfo = {
-            m_sampler,
-            m_texView[m_window->currentFrame()],
-            VK_IMAGE_LAYOUT_GENERAL
-        };
         descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descWrite.dstSet = m_descSet[frame];
         descWrite.dstBinding = 0;
-        descWrite.descriptorCount = 1;
+        descWrite.descriptorCount = m_uploadMode == CompressedUpload ? 3 : 1;
         descWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descWrite.pImageInfo = &descImageInfo;
+        descWrite.pImageInfo = descImageInfo;
         m_devFuncs->vkUpdateDescriptorSets(dev, 1, &descWrite, 0, nullptr);
     }
 
-    // Now copy the actual pixel data, but only the dirty areas.
-    if (!m_texDirty[frame].isEmpty()) {
-        if (!writeLinearImage(*m_source, m_texImage[frame], m_texMem, frame * m_oneImageSize, m_texDirty[frame]))
-            qWarning("Failed to write image to host visible memory");
+    VkCommandBuffer cb = m_window->currentCommandBuffer();
+
+    // Now copy the actual pixel data, but only the dirty areas. With staging
+    // this also records the buffer to image copies, outside the render pass.
+    // Hot tiles need frames to cool down even when nothing changes.
+    const bool coolDown = m_uploadMode == CompressedUpload && m_tileCache.hotTileCount();
+    QRegion recompressed;
+    if (hasTex && (m_texSerial[tex] != m_sourceSerial || coolDown)) {
+        ScopedStageTimer t(profiler, FrameProfiler::Upload);
+        const QRegion texDirty = pendingDirtyRegion(tex);
+        switch (m_uploadMode) {
+        case StagingUpload:
+        {
+            // Copies have to start at a multiple of 4 bytes in the buffer.
+            const QRegion stagingDirty = m_texBpp < 4 ? alignedLeft(texDirty, 4 / m_texBpp) : texDirty;
+            writeStagingBuffer(*m_source, frame, stagingDirty);
+            recordStagingUpload(cb, frame, stagingDirty);
+        }
+            break;
+        case SharedUpload:
+            recordSharedUpload(cb, frame, *m_source, texDirty);
+            break;
+        case CompressedUpload:
+            recordCompressedUpload(cb, frame, *m_source, texDirty, &recompressed);
+            break;
+        default:
+            writeLinearImage(*m_source, frame, texDirty);
+            break;
+        }
 
-        m_texDirty[frame] = QRegion();
+        m_texSerial[tex] = m_sourceSerial;
     }
 
-    VkCommandBuffer cb = m_window->currentCommandBuffer();
+    // What changed on screen, in swapchain image pixels, as long as nothing
+    // moved.
     const QSize sz = m_window->swapChainImageSize();
+    QRegion damage;
+    if (newSource && hasTex)
+        damage += quadDamage(m_mvp, dirtyRegion, m_contentSize);
+    if (!recompressed.isEmpty())
+        damage += quadDamage(m_mvp, recompressed, m_contentSize);
+
+    // The panels share one atlas, all of their changes go in one upload.
+    const bool hasPanels = m_window->hasSceneManager() && !m_window->sceneManager()->scenes().isEmpty();
+    if (hasPanels && ensurePanelResources()) {
+        if (m_window->isQuickLodRendering()) {
+            for (QuickScene *scene : m_window->sceneManager()->scenes())
+                scene->updateFootprint(quadFootprint(m_mvp * scene->transform()));
+        }
+        uploadPanels(cb, frame, &damage);
+    }
 
+    // The background animation would defeat on-demand rendering.
     static float g = 0.0f;
-    g += 0.005f;
-    if (g > 1.0f)
-        g = 0.0f;
+    if (!m_window->isOnDemandRendering()) {
+        g += 0.005f;
+        if (g > 1.0f)
+            g = 0.0f;
+    }
     VkClearColorValue clearColor = { 0, g, 0, 1 };
     VkClearDepthStencilValue clearDS = { 1, 0 };
     VkClearValue clearValues[2];
@@ -729,50 +1902,177 @@ void VulkanRenderer::startNextFrame()
     clearValues[0].color = clearColor;
     clearValues[1].depthStencil = clearDS;
 
+    const QSizeF uvScale(m_contentSize.width() == m_texSize.width() ? 1.0 : (m_contentSize.width() - 0.5) / m_texSize.width(),
+                         m_contentSize.height() == m_texSize.height() ? 1.0 : (m_contentSize.height() - 0.5) / m_texSize.height());
+    const int panelCount = hasPanels && m_instanceBufMem.ptr ? writePanelInstances(frame) : 0;
+
+    // Anything that affects the whole image. The panel instances hold their
+    // transforms and atlas rects.
+    QRect area(QPoint(0, 0), sz);
+    if (m_window->isDamageTracking()) {
+        QByteArray state(reinterpret_cast<const char *>(m_mvp.constData()), 16 * sizeof(float));
+        const float values[] = {
+            g, float(uvScale.width()), float(uvScale.height()),
+            float(m_contentSize.width()), float(m_contentSize.height()), float(sz.width()), float(sz.height())
+        };
+        state.append(reinterpret_cast<const char *>(values), sizeof(values));
+        if (panelCount)
+            state.append(reinterpret_cast<const char *>(m_instanceBufMem.ptr + frame * m_oneInstanceBufSize),
+                         panelCount * int(PANEL_INSTANCE_SIZE));
+        area = trackDamage(state, damage);
+    } else {
+        profiler->addDamage(qint64(sz.width()) * sz.height(), qint64(sz.width()) * sz.height());
+    }
+    const bool partial = area != QRect(QPoint(0, 0), sz);
+
     VkRenderPassBeginInfo rpBeginInfo;
     memset(&rpBeginInfo, 0, sizeof(rpBeginInfo));
     rpBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    rpBeginInfo.renderPass = m_window->defaultRenderPass();
+    rpBeginInfo.renderPass = partial ? m_partialRenderPass : m_window->defaultRenderPass();
     rpBeginInfo.framebuffer = m_window->currentFramebuffer();
-    rpBeginInfo.renderArea.extent.width = sz.width();
-    rpBeginInfo.renderArea.extent.height = sz.height();
+    rpBeginInfo.renderArea.offset.x = area.x();
+    rpBeginInfo.renderArea.offset.y = area.y();
+    rpBeginInfo.renderArea.extent.width = area.width();
+    rpBeginInfo.renderArea.extent.height = area.height();
     rpBeginInfo.clearValueCount = 2;
     rpBeginInfo.pClearValues = clearValues;
     VkCommandBuffer cmdBuf = m_window->currentCommandBuffer();
-    m_devFuncs->vkCmdBeginRenderPass(cmdBuf, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-    m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
-    m_devFuncs->vkCmdPushConstants(cb, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, 64, m_mvp.constData());
-    m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
-                                        &m_descSet[m_window->currentFrame()], 0, nullptr);
-    VkDeviceSize vbOffset = 0;
-    m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_vertexBuf, &vbOffset);
-
-    VkViewport viewport;
-    viewport.x = viewport.y = 0;
-    viewport.width = sz.width();
-    viewport.height = sz.height();
-    viewport.minDepth = 0;
-    viewport.maxDepth = 1;
-    m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
+    const qint64 recordStart = profiler->now();
+    if (m_timestampPool) {
+        readTimestamps(frame);
+        m_devFuncs->vkCmdResetQueryPool(cb, m_timestampPool, 2 * frame, 2);
+        m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampPool, 2 * frame);
+        m_timestampFrame[frame] = m_frameCount;
+    }
 
-    VkRect2D scissor;
-    scissor.offset.x = scissor.offset.y = 0;
-    scissor.extent.width = viewport.width;
-    scissor.extent.height = viewport.height;
-    m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
+    // Nothing to draw when the image is up to date already. It stays in the
+    // present layout it was left in.
+    if (!area.isEmpty()) {
+        m_devFuncs->vkCmdBeginRenderPass(cmdBuf, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+        m_devFuncs->vkCmdPushConstants(cb, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, 64, m_mvp.constData());
+        m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                                            &m_descSet[m_window->currentFrame()], 0, nullptr);
+        if (m_vertexUvScale[frame] != uvScale) {
+            m_vertexUvScale[frame] = uvScale;
+            writeVertexData(frame, uvScale);
+        }
+        VkDeviceSize vbOffset = frame * m_oneVertexBufSize;
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_vertexBuf, &vbOffset);
+
+        VkViewport viewport;
+        viewport.x = viewport.y = 0;
+        viewport.width = sz.width();
+        viewport.height = sz.height();
+        viewport.minDepth = 0;
+        viewport.maxDepth = 1;
+        m_devFuncs->vkCmdSetViewport(cb, 0, 1, &viewport);
+
+        m_devFuncs->vkCmdSetScissor(cb, 0, 1, &rpBeginInfo.renderArea);
+
+        if (hasTex)
+            m_devFuncs->vkCmdDraw(cb, 4, 1, 0, 0);
+
+        // All panels in one instanced draw, after the main quad since they
+        // blend.
+        if (panelCount) {
+            m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_panelPipeline);
+            m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1,
+                                                &m_atlasDescSet, 0, nullptr);
+            VkBuffer panelBuffers[2] = { m_vertexBuf, m_instanceBuf };
+            VkDeviceSize panelOffsets[2] = {
+                m_window->concurrentFrameCount() * m_oneVertexBufSize,
+                frame * m_oneInstanceBufSize
+            };
+            m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 2, panelBuffers, panelOffsets);
+            m_devFuncs->vkCmdDraw(cb, 4, uint32_t(panelCount), 0, 0);
+        }
 
-    m_devFuncs->vkCmdDraw(cb, 4, 1, 0, 0);
+        m_devFuncs->vkCmdEndRenderPass(cmdBuf);
+    }
 
-    m_devFuncs->vkCmdEndRenderPass(cmdBuf);
+    if (m_timestampPool)
+        m_devFuncs->vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampPool, 2 * frame + 1);
+    profiler->addStage(FrameProfiler::Record, recordStart, profiler->now());
 
     m_window->frameReady();
+    signalFrameSubmitted();
+    m_pacer.endFrame(latched, profiler->now());
+    profiler->endFrame();
+
+    // In on-demand mode only keep going while the Quick scene still has
+    // something that did not make it into this frame.
+    // A missing texture is retried on the next frame.
+    if (!m_window->isOnDemandRendering() || m_window->hasQuickSceneChanged() || (m_source && !hasTex)
+            || (hasPanels && m_window->sceneManager()->hasChanges()))
+        requestNextFrame();
+}
 
-    m_window->requestUpdate();
+// With late latching the next frame is not started until the pacer's latch
+// time, so that input delivery and the Quick render happen as late as
+// possible while the frame still makes it before the one after it is due.
+// The wait is in the event loop, where input keeps coming in, and the
+// window holds back other update requests meanwhile.
+void VulkanRenderer::requestNextFrame()
+{
+    const qint64 latch = m_window->isLateLatching() ? m_pacer.nextLatchTime() : -1;
+    const qint64 now = m_window->profiler()->now();
+    if (latch <= now) {
+        m_window->requestUpdate();
+        return;
+    }
+
+    m_latchArmed = now;
+    m_latchTarget = latch;
+    m_latchTimer.start(int((latch - now + 500000) / 1000000));
+}
+
+// The previous submission using this frame slot has completed by now, so its
+// timestamps are available without waiting.
+void VulkanRenderer::readTimestamps(int frame)
+{
+    if (!m_timestampFrame[frame])
+        return;
+
+    quint64 timestamps[2];
+    VkResult err = m_devFuncs->vkGetQueryPoolResults(m_window->device(), m_timestampPool, 2 * frame, 2,
+                                                     sizeof(timestamps), timestamps, sizeof(quint64),
+                                                     VK_QUERY_RESULT_64_BIT);
+    if (err == VK_SUCCESS && timestamps[1] >= timestamps[0]) {
+        const double ms = (timestamps[1] - timestamps[0]) * double(m_timestampPeriod) / 1000000.0;
+        m_window->profiler()->addGpuTime(m_timestampFrame[frame], ms);
+    }
+    m_timestampFrame[frame] = 0;
+}
+
+// Each image only needs what changed since it was last uploaded to, that is
+// the union of the source's dirty regions since then. Images that fell too
+// far behind the history, or were just created, get everything. Heavily
+// fragmented regions are not worth the per-rect overhead, copy their
+// bounding rect instead.
+QRegion VulkanRenderer::pendingDirtyRegion(int image) const
+{
+    const QRect fullRect(QPoint(0, 0), m_contentSize);
+    const quint64 lastSerial = m_texSerial[image];
+
+    if (lastSerial == 0 || m_sourceSerial - lastSerial > DIRTY_HISTORY_SIZE)
+        return fullRect;
+
+    QRegion region;
+    for (quint64 serial = lastSerial + 1; serial <= m_sourceSerial; ++serial)
+        region += m_dirtyHistory[serial % DIRTY_HISTORY_SIZE];
+
+    if (region.rectCount() > MAX_DIRTY_RECTS)
+        return region.boundingRect() & fullRect;
+
+    return region & fullRect;
 }
 
-bool VulkanRenderer::createTextureImage(int count, const QSize &size, VkImage *image, VkDeviceMemory *mem,
-                                        VkImageTiling tiling, VkImageUsageFlags usage, uint32_t memIndex)
+bool VulkanRenderer::createTextureImage(int count, const QSize &size, VkFormat format, VkImage *image,
+                                        GpuAllocation *mem, VkImageTiling tiling, VkImageUsageFlags usage,
+                                        uint32_t memIndex)
 {
     VkDevice dev = m_window->device();
     for (int i = 0; i < count; ++i) {
@@ -780,55 +2080,63 @@ bool VulkanRenderer::createTextureImage(int count, const QSize &size, VkImage *i
         memset(&imageInfo, 0, sizeof(imageInfo));
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+        imageInfo.format = format;
         imageInfo.extent.width = size.width();
         imageInfo.extent.height = size.height();
         imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = 1;
+        imageInfo.mipLevels = tiling == VK_IMAGE_TILING_OPTIMAL ? m_texMipLevels : 1;
         imageInfo.arrayLayers = 1;
         imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
         imageInfo.tiling = tiling;
-        imageInfo.usage = usage;
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+        // The smaller mip levels are blitted from the larger ones.
+        imageInfo.usage = usage | (imageInfo.mipLevels > 1 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+        imageInfo.initialLayout = tiling == VK_IMAGE_TILING_LINEAR ? VK_IMAGE_LAYOUT_PREINITIALIZED
+                                                                   : VK_IMAGE_LAYOUT_UNDEFINED;
+        m_texLayout[i] = imageInfo.initialLayout;
 
         VkResult err = m_devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &image[i]);
         if (err != VK_SUCCESS) {
-            qWarning("Failed to create linear image for texture: %d", err);
+            qWarning("Failed to create image for texture: %d", err);
             return false;
         }
 
         VkMemoryRequirements memReq;
         m_devFuncs->vkGetImageMemoryRequirements(dev, image[i], &memReq);
 
+        // One allocation for all of them. Linear images stay mapped.
         if (i == 0) {
             m_oneImageSize = aligned(memReq.size, memReq.alignment);
-            const VkDeviceSize size = m_oneImageSize * count;
-            VkMemoryAllocateInfo allocInfo = {
-                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-                nullptr,
-                size,
-                memIndex
-            };
-            qDebug("allocating %u bytes for texture image", uint32_t(size));
-
-            err = m_devFuncs->vkAllocateMemory(dev, &allocInfo, nullptr, mem);
-            if (err != VK_SUCCESS) {
-                qWarning("Failed to allocate memory for linear image: %d", err);
+            VkMemoryRequirements allReq = memReq;
+            allReq.size = m_oneImageSize * count;
+            qDebug("allocating %u bytes for texture image", uint32_t(allReq.size));
+            const GpuMemoryAllocator::ResourceKind kind = tiling == VK_IMAGE_TILING_OPTIMAL
+                    ? GpuMemoryAllocator::OptimalResource : GpuMemoryAllocator::LinearResource;
+            if (!m_memory.allocate(allReq, memIndex, kind, mem)) {
+                qWarning("Failed to allocate memory for texture image");
                 return false;
             }
         }
 
-        err = m_devFuncs->vkBindImageMemory(dev, image[i], *mem, m_oneImageSize * i);
+        err = m_devFuncs->vkBindImageMemory(dev, image[i], mem->memory, mem->offset + m_oneImageSize * i);
         if (err != VK_SUCCESS) {
-            qWarning("Failed to bind linear image memory: %d", err);
+            qWarning("Failed to bind texture image memory: %d", err);
             return false;
         }
+
+        if (tiling == VK_IMAGE_TILING_LINEAR) {
+            VkImageSubresource subres = {
+                VK_IMAGE_ASPECT_COLOR_BIT,
+                0, // mip level
+                0
+            };
+            m_devFuncs->vkGetImageSubresourceLayout(dev, image[i], &subres, &m_texSubresLayout[i]);
+        }
     }
 
     return true;
 }
 
-bool VulkanRenderer::createTextureImageView(VkImage image, VkImageView *view) const
+bool VulkanRenderer::createTextureImageView(VkImage image, VkFormat format, VkImageView *view) const
 {
     VkDevice dev = m_window->device();
 
@@ -837,13 +2145,25 @@ bool VulkanRenderer::createTextureImageView(VkImage image, VkImageView *view) co
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+    viewInfo.format = format;
     viewInfo.components.r = VK_COMPONENT_SWIZZLE_R;
     viewInfo.components.g = VK_COMPONENT_SWIZZLE_G;
     viewInfo.components.b = VK_COMPONENT_SWIZZLE_B;
     viewInfo.components.a = VK_COMPONENT_SWIZZLE_A;
+    if (format == VK_FORMAT_B4G4R4A4_UNORM_PACK16) {
+        // QImage's ARGB4444 has alpha in the top bits, where Vulkan has blue.
+        viewInfo.components.r = VK_COMPONENT_SWIZZLE_G;
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_R;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_A;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_B;
+    } else if (format == VK_FORMAT_R8_UNORM) {
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_R;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_R;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_ONE;
+    }
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo.subresourceRange.levelCount = viewInfo.subresourceRange.layerCount = 1;
+    viewInfo.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    viewInfo.subresourceRange.layerCount = 1;
 
     VkResult err = m_devFuncs->vkCreateImageView(dev, &viewInfo, nullptr, view);
     if (err != VK_SUCCESS) {
@@ -854,40 +2174,1067 @@ bool VulkanRenderer::createTextureImageView(VkImage image, VkImageView *view) co
     return true;
 }
 
-bool VulkanRenderer::writeLinearImage(const QImage &img, VkImage image, VkDeviceMemory memory,
-                                      int offset, const QRegion &dirtyRegion) const
+void VulkanRenderer::writeLinearImage(const QImage &img, int frame, const QRegion &dirtyRegion)
+{
+    const VkSubresourceLayout &layout(m_texSubresLayout[frame]);
+    writeDirtyRects(img, m_texMem, frame * m_oneImageSize + layout.offset, layout.rowPitch, dirtyRegion);
+}
+
+// Copies the dirty rects of img into persistently mapped memory where the
+// image data starts at offset and has the given row pitch. Only the touched
+// byte ranges get flushed, and only when the memory is not host coherent.
+void VulkanRenderer::writeDirtyRects(const QImage &img, const GpuAllocation &mem, VkDeviceSize offset,
+                                     VkDeviceSize rowPitch, const QRegion &dirtyRegion)
+{
+    const int bpp = img.depth() / 8;
+    const QVector<QRect> rects = coalesceDirtyRects(dirtyRegion, bpp);
+    copyDirtyRects(mem.ptr + offset, rowPitch, img, rects);
+
+    qint64 bytes = 0;
+    for (const QRect &r : rects)
+        bytes += qint64(r.width()) * r.height() * bpp;
+    m_window->profiler()->addUploadBytes(bytes);
+
+    if (m_memory.isCoherent(mem))
+        return;
+
+    QVarLengthArray<VkMappedMemoryRange, 32> ranges;
+    for (const QRect &r : rects) {
+        const VkDeviceSize start = offset + rowPitch * r.y() + r.x() * bpp;
+        const VkDeviceSize end = offset + rowPitch * (r.y() + r.height() - 1) + (r.x() + r.width()) * bpp;
+        ranges.append(m_memory.mappedRange(mem, start, end - start));
+    }
+    VkResult err = m_devFuncs->vkFlushMappedMemoryRanges(m_window->device(), uint32_t(ranges.count()), ranges.constData());
+    if (err != VK_SUCCESS)
+        qWarning("Failed to flush mapped memory: %d", err);
+}
+
+// The staging buffers mirror the layout of the full image, so a dirty rect
+// ends up at the same offset it would have in a linear image.
+bool VulkanRenderer::createStagingBuffers(int count, const QSize &size)
 {
     VkDevice dev = m_window->device();
+    const VkDeviceSize bufSize = VkDeviceSize(size.width()) * size.height() * m_texBpp;
 
-    VkImageSubresource subres = {
-        VK_IMAGE_ASPECT_COLOR_BIT,
-        0, // mip level
-        0
-    };
-    VkSubresourceLayout layout;
-    m_devFuncs->vkGetImageSubresourceLayout(dev, image, &subres, &layout);
+    for (int i = 0; i < count; ++i) {
+        VkBufferCreateInfo bufInfo;
+        memset(&bufInfo, 0, sizeof(bufInfo));
+        bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufInfo.size = bufSize;
+        bufInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_stagingBuf[i]);
+        if (err != VK_SUCCESS) {
+            qWarning("Failed to create staging buffer: %d", err);
+            return false;
+        }
+
+        VkMemoryRequirements memReq;
+        m_devFuncs->vkGetBufferMemoryRequirements(dev, m_stagingBuf[i], &memReq);
+
+        // Stays mapped for the lifetime of the buffers.
+        if (i == 0) {
+            m_oneStagingSize = aligned(memReq.size, memReq.alignment);
+            VkMemoryRequirements allReq = memReq;
+            allReq.size = m_oneStagingSize * count;
+            qDebug("allocating %u bytes for staging buffers", uint32_t(allReq.size));
+            if (!m_memory.allocate(allReq, m_window->hostVisibleMemoryIndex(), GpuMemoryAllocator::LinearResource,
+                                   &m_stagingMem)) {
+                qWarning("Failed to allocate memory for staging buffers");
+                return false;
+            }
+        }
+
+        err = m_devFuncs->vkBindBufferMemory(dev, m_stagingBuf[i], m_stagingMem.memory,
+                                             m_stagingMem.offset + m_oneStagingSize * i);
+        if (err != VK_SUCCESS) {
+            qWarning("Failed to bind staging buffer memory: %d", err);
+            return false;
+        }
+    }
 
-    uchar *p;
-    VkResult err = m_devFuncs->vkMapMemory(dev, memory, layout.offset + offset,
-                                           layout.size, 0, reinterpret_cast<void **>(&p));
+    return true;
+}
+
+void VulkanRenderer::writeStagingBuffer(const QImage &img, int frame, const QRegion &dirtyRegion)
+{
+    writeDirtyRects(img, m_stagingMem, frame * m_oneStagingSize, m_texSize.width() * m_texBpp, dirtyRegion);
+}
+
+void VulkanRenderer::recordStagingUpload(VkCommandBuffer cb, int frame, const QRegion &dirtyRegion)
+{
+    QVarLengthArray<VkBufferImageCopy, 32> copies;
+    for (const QRect &r : dirtyRegion) {
+        VkBufferImageCopy copy;
+        memset(&copy, 0, sizeof(copy));
+        copy.bufferOffset = (VkDeviceSize(r.y()) * m_texSize.width() + r.x()) * m_texBpp;
+        copy.bufferRowLength = m_texSize.width();
+        copy.bufferImageHeight = m_texSize.height();
+        copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset.x = r.x();
+        copy.imageOffset.y = r.y();
+        copy.imageExtent.width = r.width();
+        copy.imageExtent.height = r.height();
+        copy.imageExtent.depth = 1;
+        copies.append(copy);
+    }
+
+    recordImageUpload(cb, m_texImage[frame], &m_texLayout[frame], m_stagingBuf[frame], copies.constData(), copies.count(),
+                      m_texMipLevels);
+}
+
+// Upload buffers are per frame slot, and only reused once QVulkanWindow has
+// waited for that slot's fence, so the GPU is done reading from them by the
+// time we write to them again, and they can be reallocated without any
+// further synchronization.
+bool VulkanRenderer::ensureUploadBuffer(UploadBuffer *b, VkDeviceSize size)
+{
+    if (b->size >= size)
+        return true;
+
+    releaseUploadBuffer(b);
+
+    // Round up to avoid reallocating for every slightly larger update.
+    const VkDeviceSize bufSize = qMax<VkDeviceSize>(64 * 1024, qNextPowerOfTwo(quint64(size)));
+
+    VkDevice dev = m_window->device();
+    VkBufferCreateInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(bufInfo));
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.size = bufSize;
+    bufInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &b->buf);
     if (err != VK_SUCCESS) {
-        qWarning("Failed to map memory for linear image: %d", err);
+        qWarning("Failed to create upload buffer: %d", err);
         return false;
     }
 
-    for (const QRect &r : dirtyRegion) {
-        const int bpp = 4;
-        const int preamble = r.x() * bpp;
-        for (int y = r.y(); y < r.y() + r.height(); ++y) {
-            const uchar *line = img.constScanLine(y);
-            memcpy(p + layout.rowPitch * y + preamble, line + preamble, r.width() * bpp);
+    // Stays mapped for the lifetime of the buffer.
+    VkMemoryRequirements memReq;
+    m_devFuncs->vkGetBufferMemoryRequirements(dev, b->buf, &memReq);
+    qDebug("allocating %u bytes for upload buffer", uint32_t(memReq.size));
+    if (!m_memory.allocate(memReq, m_window->hostVisibleMemoryIndex(), GpuMemoryAllocator::LinearResource, &b->mem)) {
+        qWarning("Failed to allocate memory for upload buffer");
+        return false;
+    }
+
+    err = m_devFuncs->vkBindBufferMemory(dev, b->buf, b->mem.memory, b->mem.offset);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to bind upload buffer memory: %d", err);
+        return false;
+    }
+
+    b->size = bufSize;
+    return true;
+}
+
+void VulkanRenderer::releaseUploadBuffer(UploadBuffer *b)
+{
+    VkDevice dev = m_window->device();
+
+    if (b->buf) {
+        m_devFuncs->vkDestroyBuffer(dev, b->buf, nullptr);
+        b->buf = VK_NULL_HANDLE;
+    }
+    m_memory.free(&b->mem);
+    b->size = 0;
+}
+
+void VulkanRenderer::releaseUploadRing()
+{
+    for (int i = 0; i < m_window->concurrentFrameCount(); ++i)
+        releaseUploadBuffer(&m_uploadRing[i]);
+}
+
+void VulkanRenderer::flushUploadBuffer(const UploadBuffer &b, VkDeviceSize size)
+{
+    m_memory.flush(b.mem, 0, size);
+}
+
+// Copies the rects of img tightly packed into b at *offset, which is
+// advanced, and adds the copies that put them at dstOrigin + rect in the
+// image.
+void VulkanRenderer::packRects(UploadBuffer *b, VkDeviceSize *offset, const QImage &img,
+                               const QVector<QRect> &rects, const QPoint &dstOrigin,
+                               QVarLengthArray<VkBufferImageCopy, 32> *copies)
+{
+    const VkDeviceSize base = aligned(*offset, UPLOAD_ALIGN);
+    QVector<size_t> offsets;
+    copyRectsPacked(b->mem.ptr + base, img, rects, UPLOAD_ALIGN, &offsets);
+
+    for (int i = 0; i < rects.count(); ++i) {
+        const QRect &r(rects[i]);
+        VkBufferImageCopy copy;
+        memset(&copy, 0, sizeof(copy));
+        copy.bufferOffset = base + offsets[i];
+        // Tightly packed.
+        copy.bufferRowLength = 0;
+        copy.bufferImageHeight = 0;
+        copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset.x = dstOrigin.x() + r.x();
+        copy.imageOffset.y = dstOrigin.y() + r.y();
+        copy.imageExtent.width = r.width();
+        copy.imageExtent.height = r.height();
+        copy.imageExtent.depth = 1;
+        copies->append(copy);
+    }
+
+    const VkDeviceSize size = packedRectsSize(rects, img.depth() / 8, UPLOAD_ALIGN);
+    m_window->profiler()->addUploadBytes(qint64(size));
+    *offset = base + size;
+}
+
+// Packs the dirty rects back to back into this frame's upload buffer and
+// copies them into the one shared image. Unlike the other modes the host
+// side only ever touches the changed pixels, regardless of the image size.
+void VulkanRenderer::recordSharedUpload(VkCommandBuffer cb, int frame, const QImage &img,
+                                        const QRegion &dirtyRegion)
+{
+    const QVector<QRect> rects = coalesceDirtyRects(dirtyRegion, img.depth() / 8);
+    const VkDeviceSize size = packedRectsSize(rects, img.depth() / 8, UPLOAD_ALIGN);
+    UploadBuffer *b = &m_uploadRing[frame];
+    if (!size || !ensureUploadBuffer(b, size))
+        return;
+
+    QVarLengthArray<VkBufferImageCopy, 32> copies;
+    VkDeviceSize offset = 0;
+    packRects(b, &offset, img, rects, QPoint(0, 0), &copies);
+    flushUploadBuffer(*b, offset);
+
+    recordImageUpload(cb, m_texImage[0], &m_texLayout[0], b->buf, copies.constData(), copies.count(),
+                      m_texMipLevels);
+}
+
+// Device local, optimal tiled image with its own memory and a view. Only
+// used for the tile images of compressed mode.
+bool VulkanRenderer::createTileImage(const QSize &size, VkFormat format, VkImage *image, GpuAllocation *mem,
+                                     VkImageView *view)
+{
+    VkDevice dev = m_window->device();
+
+    VkImageCreateInfo imageInfo;
+    memset(&imageInfo, 0, sizeof(imageInfo));
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent.width = size.width();
+    imageInfo.extent.height = size.height();
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkResult err = m_devFuncs->vkCreateImage(dev, &imageInfo, nullptr, image);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to create tile image: %d", err);
+        return false;
+    }
+
+    VkMemoryRequirements memReq;
+    m_devFuncs->vkGetImageMemoryRequirements(dev, *image, &memReq);
+    qDebug("allocating %u bytes for %dx%d tile image", uint32_t(memReq.size), size.width(), size.height());
+    if (!m_memory.allocate(memReq, m_window->deviceLocalMemoryIndex(), GpuMemoryAllocator::OptimalResource, mem)) {
+        qWarning("Failed to allocate memory for tile image");
+        return false;
+    }
+
+    err = m_devFuncs->vkBindImageMemory(dev, *image, mem->memory, mem->offset);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to bind tile image memory: %d", err);
+        return false;
+    }
+
+    return createTextureImageView(*image, format, view);
+}
+
+// The hot pool and the indirection image of compressed mode, for a
+// compressed image of the given size. All tiles start out cold.
+bool VulkanRenderer::createTileImages(const QSize &size)
+{
+    const QSize poolSize(HOT_POOL_SIZE, HOT_POOL_SIZE);
+    m_tileCache.reset(size, poolSize);
+    m_hotLayout = m_tileLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (!createTileImage(poolSize, VK_FORMAT_B8G8R8A8_UNORM, &m_hotImage, &m_hotMem, &m_hotView)
+            || !createTileImage(m_tileCache.gridSize(), VK_FORMAT_R8G8B8A8_UNORM,
+                                &m_tileImage, &m_tileMem, &m_tileView))
+    {
+        qWarning("Failed to create tile images");
+        return false;
+    }
+
+    return true;
+}
+
+// Changed tiles go uncompressed into the hot pool, where only their dirty
+// rects need uploading from then on. Tiles that have been stable for a
+// while, or lost their slot to a busier one, are BC3 encoded on the CPU and
+// move to the compressed image. All of it is staged in this frame's upload
+// buffer.
+void VulkanRenderer::recordCompressedUpload(VkCommandBuffer cb, int frame, const QImage &img,
+                                            const QRegion &dirtyRegion, QRegion *recompressed)
+{
+    TileCache::Update update;
+    m_tileCache.update(dirtyRegion, m_frameCount, MAX_COOL_DOWNS_PER_FRAME, &update);
+
+    // Compression is lossy, tiles moving to or from the compressed image
+    // look a little different all over, not just where they changed.
+    const QRect content(QPoint(0, 0), img.size());
+    for (const QRect &tile : qAsConst(update.encodes))
+        *recompressed += tile & content;
+    for (const TileCache::HotWrite &w : qAsConst(update.hotWrites)) {
+        if (w.full)
+            *recompressed += w.tile & content;
+    }
+
+    QVector<QVector<QRect> > hotRects;
+    hotRects.reserve(update.hotWrites.count());
+    VkDeviceSize size = 0;
+    for (const TileCache::HotWrite &w : qAsConst(update.hotWrites)) {
+        const QRect tile = w.tile & content;
+        hotRects.append(w.full ? QVector<QRect>() << tile : coalesceDirtyRects(dirtyRegion & tile, 4));
+        size += UPLOAD_ALIGN + packedRectsSize(hotRects.last(), 4, UPLOAD_ALIGN);
+    }
+    for (const QRect &tile : qAsConst(update.encodes))
+        size += UPLOAD_ALIGN + bc3EncodedSize(tile);
+    const QVector<quint32> &indirection(m_tileCache.indirection());
+    const bool writeIndirection = update.indirectionChanged || m_tileLayout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    if (writeIndirection)
+        size += UPLOAD_ALIGN + indirection.count() * sizeof(quint32);
+
+    UploadBuffer *b = &m_uploadRing[frame];
+    if (size && !ensureUploadBuffer(b, size))
+        return;
+
+    QVarLengthArray<VkBufferImageCopy, 32> hotCopies;
+    VkDeviceSize offset = 0;
+    for (int i = 0; i < hotRects.count(); ++i) {
+        const TileCache::HotWrite &w(update.hotWrites[i]);
+        packRects(b, &offset, img, hotRects[i], w.slot - w.tile.topLeft(), &hotCopies);
+    }
+
+    VkBufferImageCopy copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.imageSubresource.layerCount = 1;
+    copy.imageExtent.depth = 1;
+
+    QVarLengthArray<VkBufferImageCopy, 32> coldCopies;
+    for (const QRect &tile : qAsConst(update.encodes)) {
+        offset = aligned(offset, UPLOAD_ALIGN);
+        encodeBC3(b->mem.ptr + offset, img, tile);
+        copy.bufferOffset = offset;
+        copy.imageOffset.x = tile.x();
+        copy.imageOffset.y = tile.y();
+        copy.imageExtent.width = tile.width();
+        copy.imageExtent.height = tile.height();
+        coldCopies.append(copy);
+        offset += bc3EncodedSize(tile);
+        m_window->profiler()->addUploadBytes(qint64(bc3EncodedSize(tile)));
+    }
+
+    QVarLengthArray<VkBufferImageCopy, 32> tileCopies;
+    if (writeIndirection) {
+        offset = aligned(offset, UPLOAD_ALIGN);
+        const VkDeviceSize bytes = indirection.count() * sizeof(quint32);
+        memcpy(b->mem.ptr + offset, indirection.constData(), bytes);
+        copy.bufferOffset = offset;
+        copy.imageOffset.x = copy.imageOffset.y = 0;
+        copy.imageExtent.width = m_tileCache.gridSize().width();
+        copy.imageExtent.height = m_tileCache.gridSize().height();
+        tileCopies.append(copy);
+        offset += bytes;
+        m_window->profiler()->addUploadBytes(qint64(bytes));
+    }
+
+    flushUploadBuffer(*b, offset);
+
+    // All three have to be ready for sampling, even if never written to.
+    if (!hotCopies.isEmpty() || m_hotLayout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        recordImageUpload(cb, m_hotImage, &m_hotLayout, b->buf, hotCopies.constData(), hotCopies.count());
+    if (!coldCopies.isEmpty() || m_texLayout[0] != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        recordImageUpload(cb, m_texImage[0], &m_texLayout[0], b->buf, coldCopies.constData(), coldCopies.count());
+    if (!tileCopies.isEmpty())
+        recordImageUpload(cb, m_tileImage, &m_tileLayout, b->buf, tileCopies.constData(), tileCopies.count());
+}
+
+// Records the copies with the layout transitions around them. For a shared
+// image the first barrier also makes the copy wait for the fragment shader
+// reads of the previous, potentially still executing, frames on the queue.
+// Without copies this only makes a new image ready for sampling. With more
+// than one mip level the copied areas are propagated down the mip chain.
+void VulkanRenderer::recordImageUpload(VkCommandBuffer cb, VkImage image, VkImageLayout *layout, VkBuffer buffer,
+                                       const VkBufferImageCopy *copies, int copyCount, int mipLevels)
+{
+    VkImageMemoryBarrier barrier;
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = uint32_t(mipLevels);
+    barrier.subresourceRange.layerCount = 1;
+    barrier.image = image;
+
+    // The previous contents are only worth preserving when the image has
+    // been written to before.
+    const bool initialized = *layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.oldLayout = *layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = initialized ? VK_ACCESS_SHADER_READ_BIT : 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    m_devFuncs->vkCmdPipelineBarrier(cb,
+                                     initialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    if (copyCount) {
+        m_devFuncs->vkCmdCopyBufferToImage(cb, buffer, image,
+                                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                           uint32_t(copyCount), copies);
+    }
+
+    if (mipLevels == 1) {
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+    } else {
+        recordMipBlits(cb, image, mipLevels, copies, copyCount);
+
+        // All levels but the last were blitted from.
+        VkImageMemoryBarrier barriers[2] = { barrier, barrier };
+        barriers[0].subresourceRange.levelCount = uint32_t(mipLevels - 1);
+        barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barriers[1].subresourceRange.baseMipLevel = uint32_t(mipLevels - 1);
+        barriers[1].subresourceRange.levelCount = 1;
+        barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        for (VkImageMemoryBarrier &b : barriers) {
+            b.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            b.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
         }
+        m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                         0, 0, nullptr, 0, nullptr, 2, barriers);
+    }
+
+    *layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
+
+// Regenerates the parts of the smaller mip levels of the Quick texture that
+// the copies into level 0 affect, level by level, each from the one above.
+// Leaves the last level in TRANSFER_DST and all others in TRANSFER_SRC.
+void VulkanRenderer::recordMipBlits(VkCommandBuffer cb, VkImage image, int mipLevels,
+                                    const VkBufferImageCopy *copies, int copyCount)
+{
+    QRegion dirty;
+    for (int i = 0; i < copyCount; ++i) {
+        dirty += QRect(copies[i].imageOffset.x, copies[i].imageOffset.y,
+                       int(copies[i].imageExtent.width), int(copies[i].imageExtent.height));
+    }
+
+    VkImageMemoryBarrier barrier;
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = barrier.subresourceRange.layerCount = 1;
+    barrier.image = image;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    QSize srcSize = m_texSize;
+    for (int level = 1; level < mipLevels; ++level) {
+        barrier.subresourceRange.baseMipLevel = uint32_t(level - 1);
+        m_devFuncs->vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        // Each texel comes from the 2x2 block above it.
+        const QSize dstSize(qMax(1, srcSize.width() / 2), qMax(1, srcSize.height() / 2));
+        QRegion next;
+        for (const QRect &r : dirty)
+            next += QRect(QPoint(r.left() / 2, r.top() / 2), QPoint(r.right() / 2, r.bottom() / 2))
+                    & QRect(QPoint(0, 0), dstSize);
+
+        QVarLengthArray<VkImageBlit, 32> blits;
+        for (const QRect &r : next) {
+            VkImageBlit blit;
+            memset(&blit, 0, sizeof(blit));
+            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel = uint32_t(level - 1);
+            blit.srcSubresource.layerCount = 1;
+            blit.srcOffsets[0] = { 2 * r.x(), 2 * r.y(), 0 };
+            blit.srcOffsets[1] = { qMin(2 * (r.right() + 1), srcSize.width()),
+                                   qMin(2 * (r.bottom() + 1), srcSize.height()), 1 };
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstSubresource.mipLevel = uint32_t(level);
+            blit.dstOffsets[0] = { r.x(), r.y(), 0 };
+            blit.dstOffsets[1] = { r.right() + 1, r.bottom() + 1, 1 };
+            blits.append(blit);
+        }
+        if (!blits.isEmpty()) {
+            m_devFuncs->vkCmdBlitImage(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                       uint32_t(blits.count()), blits.constData(), VK_FILTER_LINEAR);
+        }
+
+        dirty = next;
+        srcSize = dstSize;
+    }
+}
+
+// The size of a unit quad on screen, in pixels, from the longer of each pair
+// of opposite edges. Empty when part of it is behind the camera.
+QSizeF VulkanRenderer::quadFootprint(const QMatrix4x4 &mvp) const
+{
+    const QSize sz = m_window->swapChainImageSize();
+    QPointF corners[4];
+    for (int i = 0; i < 4; ++i) {
+        const QVector4D clip = mvp * QVector4D(vertexData[i * 5], vertexData[i * 5 + 1], vertexData[i * 5 + 2], 1);
+        if (clip.w() <= 0)
+            return QSizeF();
+        corners[i] = QPointF((clip.x() / clip.w() + 1) * 0.5 * sz.width(),
+                             (clip.y() / clip.w() + 1) * 0.5 * sz.height());
+    }
+
+    // Corners are bottom left, top left, bottom right, top right.
+    auto length = [](const QPointF &a, const QPointF &b) {
+        const QPointF d = b - a;
+        return qSqrt(d.x() * d.x() + d.y() * d.y());
+    };
+    return QSizeF(qMax(length(corners[0], corners[2]), length(corners[1], corners[3])),
+                  qMax(length(corners[0], corners[1]), length(corners[2], corners[3])));
+}
+
+// The swapchain pixels that show the dirty areas of a quad's image.
+QRegion VulkanRenderer::quadDamage(const QMatrix4x4 &mvp, const QRegion &dirtyRegion, const QSize &imageSize) const
+{
+    if (imageSize.isEmpty())
+        return QRegion();
+
+    const QSize sz = m_window->swapChainImageSize();
+    const QRegion rects = dirtyRegion.rectCount() > MAX_DIRTY_RECTS ? QRegion(dirtyRegion.boundingRect()) : dirtyRegion;
+    QRegion damage;
+    for (const QRect &r : rects) {
+        const QRectF uvRect(qreal(r.x()) / imageSize.width(), qreal(r.y()) / imageSize.height(),
+                            qreal(r.width()) / imageSize.width(), qreal(r.height()) / imageSize.height());
+        const QRect projected = projectQuadRect(mvp, uvRect, sz);
+        if (!projected.isEmpty())
+            damage += projected.adjusted(-DAMAGE_MARGIN, -DAMAGE_MARGIN, DAMAGE_MARGIN, DAMAGE_MARGIN);
+    }
+    return damage;
+}
+
+// Makes the next frames draw every swapchain image in full.
+void VulkanRenderer::invalidateSwapChainContents()
+{
+    for (int i = 0; i < QVulkanWindow::MAX_SWAPCHAIN_BUFFER_COUNT; ++i)
+        m_swapImageFrame[i] = 0;
+    m_damageState.clear();
+}
+
+// Returns the area of this frame's swapchain image to draw: everything that
+// changed since the image was last drawn to, rounded out to the render area
+// granularity. That is the whole image when the state differs from the
+// previous frame, or when the image was not drawn to since the swapchain was
+// created. An empty area means the image is up to date. What changed since
+// the previous frame goes to the present.
+QRect VulkanRenderer::trackDamage(const QByteArray &state, const QRegion &damage)
+{
+    const QSize sz = m_window->swapChainImageSize();
+    const QRect fullRect(QPoint(0, 0), sz);
+
+    QRegion frameDamage = damage & fullRect;
+    if (state != m_damageState) {
+        m_damageState = state;
+        frameDamage = fullRect;
+    }
+    m_damageHistory[m_frameCount % DAMAGE_HISTORY_SIZE] = frameDamage;
+
+    const int image = m_window->currentSwapChainImageIndex();
+    const quint64 lastDrawn = m_swapImageFrame[image];
+    m_swapImageFrame[image] = m_frameCount;
+    QRegion redraw;
+    if (!m_partialRenderPass || !lastDrawn || m_frameCount - lastDrawn >= DAMAGE_HISTORY_SIZE) {
+        redraw = fullRect;
+    } else {
+        for (quint64 f = lastDrawn + 1; f <= m_frameCount; ++f)
+            redraw += m_damageHistory[f % DAMAGE_HISTORY_SIZE];
+    }
+
+    // The render area is a single rect, which may only end off the
+    // granularity at the edge of the image.
+    QRect area;
+    if (!redraw.isEmpty()) {
+        const QRect r = redraw.boundingRect();
+        const int gw = qMax<int>(1, m_renderAreaGranularity.width);
+        const int gh = qMax<int>(1, m_renderAreaGranularity.height);
+        area = QRect(QPoint(r.left() / gw * gw, r.top() / gh * gh),
+                     QPoint((r.right() / gw + 1) * gw - 1, (r.bottom() / gh + 1) * gh - 1)) & fullRect;
+    }
+
+    qint64 damagedPixels = 0;
+    for (const QRect &r : frameDamage)
+        damagedPixels += qint64(r.width()) * r.height();
+    m_window->profiler()->addDamage(qint64(area.width()) * area.height(), damagedPixels);
+
+    // No rects means the whole image changed, so an unchanged frame still
+    // claims a pixel.
+    if (m_incrementalPresent) {
+        QVector<QRect> rects;
+        if (frameDamage.isEmpty()) {
+            rects.append(QRect(0, 0, 1, 1));
+        } else if (frameDamage.rectCount() > MAX_DIRTY_RECTS) {
+            rects.append(frameDamage.boundingRect());
+        } else if (frameDamage != QRegion(fullRect)) {
+            for (const QRect &r : frameDamage)
+                rects.append(r);
+        }
+        setPresentDamage(m_window, rects);
+    }
+
+    return area;
+}
+
+// Same attachments as the default render pass, so that it works with the
+// window's framebuffers, but the swapchain image comes in with what it was
+// last presented with. Only the render area is cleared and drawn to.
+bool VulkanRenderer::createPartialRenderPass()
+{
+    if (m_window->sampleCountFlagBits() != VK_SAMPLE_COUNT_1_BIT) {
+        qWarning("Partial redraws need a single sample");
+        return false;
+    }
+
+    VkAttachmentDescription attDesc[2];
+    memset(attDesc, 0, sizeof(attDesc));
+    attDesc[0].format = m_window->colorFormat();
+    attDesc[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attDesc[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attDesc[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attDesc[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attDesc[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attDesc[0].initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attDesc[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attDesc[1].format = m_window->depthStencilFormat();
+    attDesc[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attDesc[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attDesc[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attDesc[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attDesc[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attDesc[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attDesc[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkAttachmentReference dsRef = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+    VkSubpassDescription subpassDesc;
+    memset(&subpassDesc, 0, sizeof(subpassDesc));
+    subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDesc.colorAttachmentCount = 1;
+    subpassDesc.pColorAttachments = &colorRef;
+    subpassDesc.pDepthStencilAttachment = &dsRef;
+
+    // The layout transition must wait for the acquire semaphore, which the
+    // submit waits for at the color attachment output stage, and the depth
+    // buffer is shared with the previous frame.
+    VkSubpassDependency dep;
+    memset(&dep, 0, sizeof(dep));
+    dep.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dep.dstSubpass = 0;
+    dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dep.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+            | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo rpInfo;
+    memset(&rpInfo, 0, sizeof(rpInfo));
+    rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    rpInfo.attachmentCount = 2;
+    rpInfo.pAttachments = attDesc;
+    rpInfo.subpassCount = 1;
+    rpInfo.pSubpasses = &subpassDesc;
+    rpInfo.dependencyCount = 1;
+    rpInfo.pDependencies = &dep;
+
+    VkDevice dev = m_window->device();
+    VkResult err = m_devFuncs->vkCreateRenderPass(dev, &rpInfo, nullptr, &m_partialRenderPass);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to create partial render pass: %d", err);
+        return false;
+    }
+
+    m_devFuncs->vkGetRenderAreaGranularity(dev, m_partialRenderPass, &m_renderAreaGranularity);
+    return true;
+}
+
+// The panel atlas is a single device local image, like the shared texture.
+// It only gets created once there are panels.
+bool VulkanRenderer::ensurePanelResources()
+{
+    // The instance buffer is the last thing created.
+    if (m_instanceBufMem.ptr)
+        return true;
+
+    // Whatever a previous, failed attempt left behind.
+    releasePanelResources();
+
+    VkDevice dev = m_window->device();
+    const QSize atlasSize = m_window->sceneManager()->atlasSize();
+
+    VkImageCreateInfo imageInfo;
+    memset(&imageInfo, 0, sizeof(imageInfo));
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+    imageInfo.extent.width = atlasSize.width();
+    imageInfo.extent.height = atlasSize.height();
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkResult err = m_devFuncs->vkCreateImage(dev, &imageInfo, nullptr, &m_atlasImage);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to create panel atlas: %d", err);
+        return false;
+    }
+    m_atlasLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkMemoryRequirements memReq;
+    m_devFuncs->vkGetImageMemoryRequirements(dev, m_atlasImage, &memReq);
+    qDebug("allocating %u bytes for the %dx%d panel atlas", uint32_t(memReq.size),
+           atlasSize.width(), atlasSize.height());
+    if (!m_memory.allocate(memReq, m_window->deviceLocalMemoryIndex(), GpuMemoryAllocator::OptimalResource,
+                           &m_atlasMem)) {
+        qWarning("Failed to allocate memory for panel atlas");
+        return false;
+    }
+
+    err = m_devFuncs->vkBindImageMemory(dev, m_atlasImage, m_atlasMem.memory, m_atlasMem.offset);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to bind panel atlas memory: %d", err);
+        return false;
+    }
+
+    if (!createTextureImageView(m_atlasImage, VK_FORMAT_B8G8R8A8_UNORM, &m_atlasView)) {
+        qWarning("Failed to create panel atlas view");
+        return false;
+    }
+
+    // Never changes, so one set serves all frames.
+    VkDescriptorSetAllocateInfo descSetAllocInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        nullptr,
+        m_descPool,
+        1,
+        &m_descSetLayout
+    };
+    err = m_devFuncs->vkAllocateDescriptorSets(dev, &descSetAllocInfo, &m_atlasDescSet);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to allocate panel descriptor set: %d", err);
+        return false;
+    }
+
+    VkWriteDescriptorSet descWrite;
+    memset(&descWrite, 0, sizeof(descWrite));
+    VkDescriptorImageInfo descImageInfo = {
+        m_sampler,
+        m_atlasView,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    descWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descWrite.dstSet = m_atlasDescSet;
+    descWrite.dstBinding = 0;
+    descWrite.descriptorCount = 1;
+    descWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descWrite.pImageInfo = &descImageInfo;
+    m_devFuncs->vkUpdateDescriptorSets(dev, 1, &descWrite, 0, nullptr);
+
+    // Per-frame instance data: the MVP and the atlas rect of each panel.
+    const int concurrentFrameCount = m_window->concurrentFrameCount();
+    m_oneInstanceBufSize = aligned(QuickSceneManager::MAX_SCENES * PANEL_INSTANCE_SIZE, m_nonCoherentAtomSize);
+    VkBufferCreateInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(bufInfo));
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.size = m_oneInstanceBufSize * concurrentFrameCount;
+    bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_instanceBuf);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to create panel instance buffer: %d", err);
+        return false;
+    }
+
+    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_instanceBuf, &memReq);
+    if (!m_memory.allocate(memReq, m_window->hostVisibleMemoryIndex(), GpuMemoryAllocator::LinearResource,
+                           &m_instanceBufMem)) {
+        qWarning("Failed to allocate memory for panel instances");
+        return false;
+    }
+
+    err = m_devFuncs->vkBindBufferMemory(dev, m_instanceBuf, m_instanceBufMem.memory, m_instanceBufMem.offset);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to bind panel instance memory: %d", err);
+        return false;
     }
 
-    m_devFuncs->vkUnmapMemory(dev, memory);
+    // Everything rendered so far has to go into the new atlas.
+    m_atlasNeedsFullUpload = true;
     return true;
 }
 
+void VulkanRenderer::releasePanelResources()
+{
+    VkDevice dev = m_window->device();
+
+    if (m_atlasDescSet) {
+        m_devFuncs->vkFreeDescriptorSets(dev, m_descPool, 1, &m_atlasDescSet);
+        m_atlasDescSet = VK_NULL_HANDLE;
+    }
+
+    if (m_atlasView) {
+        m_devFuncs->vkDestroyImageView(dev, m_atlasView, nullptr);
+        m_atlasView = VK_NULL_HANDLE;
+    }
+
+    if (m_atlasImage) {
+        m_devFuncs->vkDestroyImage(dev, m_atlasImage, nullptr);
+        m_atlasImage = VK_NULL_HANDLE;
+    }
+
+    m_memory.free(&m_atlasMem);
+
+    if (m_instanceBuf) {
+        m_devFuncs->vkDestroyBuffer(dev, m_instanceBuf, nullptr);
+        m_instanceBuf = VK_NULL_HANDLE;
+    }
+
+    m_memory.free(&m_instanceBufMem);
+
+    for (int i = 0; i < m_window->concurrentFrameCount(); ++i)
+        releaseUploadBuffer(&m_panelUpload[i]);
+}
+
+// Renders the panels that changed and records one upload for all of their
+// dirty areas.
+// damage receives the changed areas of the panels on screen.
+void VulkanRenderer::uploadPanels(VkCommandBuffer cb, int frame, QRegion *damage)
+{
+    QuickSceneManager *manager = m_window->sceneManager();
+
+    QVector<QuickSceneManager::Update> updates = manager->renderChangedScenes();
+
+    if (m_atlasNeedsFullUpload) {
+        m_atlasNeedsFullUpload = false;
+        updates.clear();
+        for (QuickScene *scene : manager->scenes()) {
+            if (scene->hasRendered()) {
+                QuickSceneManager::Update u = { scene, QRect(QPoint(0, 0), scene->image().size()) };
+                updates.append(u);
+            }
+        }
+    }
+
+    if (updates.isEmpty())
+        return;
+
+    for (const QuickSceneManager::Update &u : qAsConst(updates))
+        *damage += quadDamage(m_mvp * u.scene->transform(), u.dirtyRegion, u.scene->image().size());
+
+    ScopedStageTimer t(m_window->profiler(), FrameProfiler::Upload);
+
+    QVector<QVector<QRect> > rects;
+    VkDeviceSize size = 0;
+    for (const QuickSceneManager::Update &u : qAsConst(updates)) {
+        rects.append(coalesceDirtyRects(u.dirtyRegion, 4));
+        size = aligned(size, UPLOAD_ALIGN) + packedRectsSize(rects.last(), 4, UPLOAD_ALIGN);
+    }
+
+    UploadBuffer *b = &m_panelUpload[frame];
+    if (!size || !ensureUploadBuffer(b, size))
+        return;
+
+    QVarLengthArray<VkBufferImageCopy, 32> copies;
+    VkDeviceSize offset = 0;
+    for (int i = 0; i < updates.count(); ++i)
+        packRects(b, &offset, updates[i].scene->image(), rects[i], updates[i].scene->atlasRect().topLeft(), &copies);
+    flushUploadBuffer(*b, offset);
+
+    recordImageUpload(cb, m_atlasImage, &m_atlasLayout, b->buf, copies.constData(), copies.count());
+}
+
+// Returns the number of panels to draw this frame. Panels that have not been
+// rendered yet have nothing in the atlas, they are skipped.
+int VulkanRenderer::writePanelInstances(int frame)
+{
+    if (m_atlasLayout != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        return 0;
+
+    const QSize atlasSize = m_window->sceneManager()->atlasSize();
+    float *p = reinterpret_cast<float *>(m_instanceBufMem.ptr + frame * m_oneInstanceBufSize);
+    int count = 0;
+    for (QuickScene *scene : m_window->sceneManager()->scenes()) {
+        if (!scene->hasRendered())
+            continue;
+
+        const QMatrix4x4 mvp = m_mvp * scene->transform();
+        memcpy(p, mvp.constData(), 16 * sizeof(float));
+
+        // Half a texel inside the rect, linear filtering must not pick up
+        // the neighbors. At a lower render scale only the top left of the
+        // atlas rect is used.
+        const QRect r(scene->atlasRect().topLeft(), scene->image().size());
+        p[16] = (r.x() + 0.5f) / atlasSize.width();
+        p[17] = (r.y() + 0.5f) / atlasSize.height();
+        p[18] = (r.width() - 1.0f) / atlasSize.width();
+        p[19] = (r.height() - 1.0f) / atlasSize.height();
+
+        p += PANEL_INSTANCE_SIZE / sizeof(float);
+        ++count;
+    }
+
+    if (count)
+        m_memory.flush(m_instanceBufMem, frame * m_oneInstanceBufSize, m_oneInstanceBufSize);
+
+    return count;
+}
+
+// Waits until no more than the allowed number of frames, including the one
+// about to be recorded, are queued up on the GPU.
+void VulkanRenderer::waitForFramesInFlight()
+{
+    const int maxInFlight = m_window->maxFramesInFlight();
+    if (maxInFlight <= 0 || maxInFlight >= m_window->concurrentFrameCount() || m_frameCount <= quint64(maxInFlight))
+        return;
+
+    const int slot = (m_frameCount - maxInFlight) % QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+    if (!m_frameFencePending[slot])
+        return;
+
+    VkDevice dev = m_window->device();
+    m_devFuncs->vkWaitForFences(dev, 1, &m_frameFence[slot], VK_TRUE, UINT64_MAX);
+    m_devFuncs->vkResetFences(dev, 1, &m_frameFence[slot]);
+    m_frameFencePending[slot] = false;
+}
+
+// QVulkanWindow submits the frame without a fence of ours. An empty submit
+// right after it signals one when all work before it, the frame included,
+// is done.
+void VulkanRenderer::signalFrameSubmitted()
+{
+    const int maxInFlight = m_window->maxFramesInFlight();
+    if (maxInFlight <= 0 || maxInFlight >= m_window->concurrentFrameCount())
+        return;
+
+    VkDevice dev = m_window->device();
+    const int slot = m_frameCount % QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT;
+    if (m_frameFencePending[slot]) {
+        m_devFuncs->vkWaitForFences(dev, 1, &m_frameFence[slot], VK_TRUE, UINT64_MAX);
+        m_devFuncs->vkResetFences(dev, 1, &m_frameFence[slot]);
+    }
+
+    VkResult err = m_devFuncs->vkQueueSubmit(m_window->graphicsQueue(), 0, nullptr, m_frameFence[slot]);
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to submit frame fence: %d", err);
+        m_frameFencePending[slot] = false;
+        return;
+    }
+    m_frameFencePending[slot] = true;
+}
+
+// One file per device, since the data is only usable with the device (and
+// driver) it was created with.
+QString VulkanRenderer::pipelineCacheFileName() const
+{
+    const QString dir = m_window->pipelineCacheDirectory();
+    if (dir.isEmpty())
+        return QString();
+
+    const VkPhysicalDeviceProperties *props = m_window->physicalDeviceProperties();
+    return QDir(dir).filePath(QString::fromLatin1("pipelines-%1-%2.bin")
+                              .arg(props->vendorID, 4, 16, QLatin1Char('0'))
+                              .arg(props->deviceID, 4, 16, QLatin1Char('0')));
+}
+
+// The driver is supposed to reject incompatible data on its own, but not all
+// of them are that careful. Check the header (see the spec for
+// vkGetPipelineCacheData) before handing anything over.
+QByteArray VulkanRenderer::loadPipelineCacheData() const
+{
+    const QString fileName = pipelineCacheFileName();
+    if (fileName.isEmpty())
+        return QByteArray();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    const QByteArray data = file.readAll();
+    file.close();
+
+    const int headerSize = 16 + VK_UUID_SIZE;
+    const VkPhysicalDeviceProperties *props = m_window->physicalDeviceProperties();
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    if (data.size() < headerSize
+            || qFromLittleEndian<quint32>(p) < quint32(headerSize)
+            || qFromLittleEndian<quint32>(p + 4) != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+            || qFromLittleEndian<quint32>(p + 8) != props->vendorID
+            || qFromLittleEndian<quint32>(p + 12) != props->deviceID
+            || memcmp(p + 16, props->pipelineCacheUUID, VK_UUID_SIZE))
+    {
+        qDebug("Ignoring stale or invalid pipeline cache %s", qPrintable(fileName));
+        return QByteArray();
+    }
+
+    qDebug("Loaded %d bytes of pipeline cache data from %s", data.size(), qPrintable(fileName));
+    return data;
+}
+
+void VulkanRenderer::savePipelineCache()
+{
+    const QString fileName = pipelineCacheFileName();
+    if (fileName.isEmpty())
+        return;
+
+    VkDevice dev = m_window->device();
+    size_t dataSize = 0;
+    VkResult err = m_devFuncs->vkGetPipelineCacheData(dev, m_pipelineCache, &dataSize, nullptr);
+    if (err != VK_SUCCESS || !dataSize) {
+        qWarning("Failed to query pipeline cache size: %d", err);
+        return;
+    }
+
+    QByteArray data(int(dataSize), Qt::Uninitialized);
+    err = m_devFuncs->vkGetPipelineCacheData(dev, m_pipelineCache, &dataSize, data.data());
+    if (err != VK_SUCCESS) {
+        qWarning("Failed to get pipeline cache data: %d", err);
+        return;
+    }
+    data.truncate(int(dataSize));
+
+    // Write to a temporary file first so that a crash or a concurrently
+    // starting process never sees a half written cache.
+    QDir().mkpath(m_window->pipelineCacheDirectory());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning("Failed to write pipeline cache %s: %s", qPrintable(fileName), qPrintable(file.errorString()));
+        return;
+    }
+
+    qDebug("Saved %d bytes of pipeline cache data to %s", data.size(), qPrintable(fileName));
+}
+
 VkShaderModule VulkanRenderer::createShader(const QString &name)
 {
     QFile file(name);
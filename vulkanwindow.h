@@ -53,18 +53,42 @@
 
 #include <QVulkanWindow>
 #include <QImage>
+#include <QVarLengthArray>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+#include "frameprofiler.h"
+#include "tilecache.h"
+#include "renderscale.h"
+#include "framepacer.h"
+#include "gpumemory.h"
 
 class QQuickRenderControl;
 class QQuickWindow;
 class QQmlEngine;
 class QQmlComponent;
 class QQuickItem;
+class QTimer;
+class QMouseEvent;
+class QTouchEvent;
+class QWheelEvent;
 
 class VulkanWindowWithSwQuick;
+class QuickRenderThread;
+class QuickSceneManager;
+class TiledQuickRenderer;
+class QSGRenderer;
 
 class VulkanRenderer : public QVulkanWindowRenderer
 {
 public:
+    enum UploadMode {
+        LinearUpload,
+        StagingUpload,
+        SharedUpload,
+        CompressedUpload
+    };
+
     VulkanRenderer(VulkanWindowWithSwQuick *w);
 
     void initResources() override;
@@ -76,29 +100,171 @@ public:
 
     QMatrix4x4 modelView() const { return m_modelView; }
     QMatrix4x4 projection() const { return m_projection; }
+    QMatrix4x4 mvp() const { return m_mvp; }
+    GpuMemoryStats memoryStats() const { return m_memory.stats(); }
+    bool isWaitingForLatch() const { return m_latchTimer.isActive(); }
+    void invalidateSwapChainContents();
 
 private:
-    bool createTextureImage(int count, const QSize &size, VkImage *image, VkDeviceMemory *mem,
+    bool createTextureImage(int count, const QSize &size, VkFormat format, VkImage *image, GpuAllocation *mem,
                             VkImageTiling tiling, VkImageUsageFlags usage, uint32_t memIndex);
-    bool createTextureImageView(VkImage image, VkImageView *view) const;
-    bool writeLinearImage(const QImage &img, VkImage image, VkDeviceMemory memory,
-                          int offset, const QRegion &dirtyRegion) const;
+    bool createTextureImageView(VkImage image, VkFormat format, VkImageView *view) const;
+    void writeLinearImage(const QImage &img, int frame, const QRegion &dirtyRegion);
+    void writeDirtyRects(const QImage &img, const GpuAllocation &mem, VkDeviceSize offset, VkDeviceSize rowPitch,
+                         const QRegion &dirtyRegion);
+    bool createStagingBuffers(int count, const QSize &size);
+    void writeStagingBuffer(const QImage &img, int frame, const QRegion &dirtyRegion);
+    void recordStagingUpload(VkCommandBuffer cb, int frame, const QRegion &dirtyRegion);
+    struct UploadBuffer {
+        VkBuffer buf;
+        GpuAllocation mem;
+        VkDeviceSize size;
+    };
+    bool ensureUploadBuffer(UploadBuffer *b, VkDeviceSize size);
+    void releaseUploadBuffer(UploadBuffer *b);
+    void flushUploadBuffer(const UploadBuffer &b, VkDeviceSize size);
+    void packRects(UploadBuffer *b, VkDeviceSize *offset, const QImage &img,
+                   const QVector<QRect> &rects, const QPoint &dstOrigin,
+                   QVarLengthArray<VkBufferImageCopy, 32> *copies);
+    void releaseUploadRing();
+    void recordSharedUpload(VkCommandBuffer cb, int frame, const QImage &img, const QRegion &dirtyRegion);
+    bool createTileImage(const QSize &size, VkFormat format, VkImage *image, GpuAllocation *mem,
+                         VkImageView *view);
+    bool createTileImages(const QSize &size);
+    void recordCompressedUpload(VkCommandBuffer cb, int frame, const QImage &img, const QRegion &dirtyRegion,
+                                QRegion *recompressed);
+    void recordImageUpload(VkCommandBuffer cb, VkImage image, VkImageLayout *layout, VkBuffer buffer,
+                           const VkBufferImageCopy *copies, int copyCount, int mipLevels = 1);
+    void recordMipBlits(VkCommandBuffer cb, VkImage image, int mipLevels,
+                        const VkBufferImageCopy *copies, int copyCount);
+    QSizeF quadFootprint(const QMatrix4x4 &mvp) const;
+    void waitForFramesInFlight();
+    void signalFrameSubmitted();
+    void requestNextFrame();
+    bool ensurePanelResources();
+    void releasePanelResources();
+    void uploadPanels(VkCommandBuffer cb, int frame, QRegion *damage);
+    int writePanelInstances(int frame);
+    // With a shared texture all frames sample the same image.
+    int textureIndex(int frame) const
+    {
+        return m_uploadMode == SharedUpload || m_uploadMode == CompressedUpload ? 0 : frame;
+    }
+    bool createTex(const QSize &size);
     void releaseTex();
+    void retireTex();
+    void releaseImageLater(VkImage image);
+    void releaseImageViewLater(VkImageView view);
+    void releaseBufferLater(VkBuffer buffer);
+    void releaseMemoryLater(GpuAllocation *mem);
+    void releaseDeferred(bool all);
+    QSize textureCapacity(const QSize &size) const;
+    void writeVertexData(int slot, const QSizeF &scale);
+    QRegion pendingDirtyRegion(int image) const;
     VkShaderModule createShader(const QString &name);
+    void readTimestamps(int frame);
+    QString pipelineCacheFileName() const;
+    QByteArray loadPipelineCacheData() const;
+    bool createPartialRenderPass();
+    QRegion quadDamage(const QMatrix4x4 &mvp, const QRegion &dirtyRegion, const QSize &imageSize) const;
+    QRect trackDamage(const QByteArray &state, const QRegion &damage);
+    void savePipelineCache();
 
     VulkanWindowWithSwQuick *m_window;
     QVulkanDeviceFunctions *m_devFuncs;
 
-    VkDeviceMemory m_texMem = VK_NULL_HANDLE;
-    QRegion m_texDirty[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    UploadMode m_uploadMode = LinearUpload;
+    bool m_mipmaps = false;
+    int m_texMipLevels = 1;
+    // Matches the Quick image, the view swizzles what differs in channel
+    // order.
+    VkFormat m_texFormat = VK_FORMAT_B8G8R8A8_UNORM;
+    int m_texBpp = 4;
+    VkDeviceSize m_nonCoherentAtomSize = 1;
+
+    // All device memory comes from here, the allocations below are null
+    // until their resources are created.
+    GpuMemoryAllocator m_memory;
+
+    GpuAllocation m_texMem = {};
+    // Serial of the source image each texture image was last updated from,
+    // 0 when it was never written to.
+    quint64 m_texSerial[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    quint64 m_sourceSerial = 0;
+    static const int DIRTY_HISTORY_SIZE = 8;
+    static const int MAX_DIRTY_RECTS = 64;
+    QRegion m_dirtyHistory[DIRTY_HISTORY_SIZE];
     VkImage m_texImage[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
     VkImageView m_texView[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    VkImageLayout m_texLayout[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    // The images may be larger than the content, so that small resizes can
+    // reuse them.
     QSize m_texSize;
+    QSize m_contentSize;
     VkDeviceSize m_oneImageSize;
-    QImage *m_source;
+    VkSubresourceLayout m_texSubresLayout[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+
+    GpuAllocation m_stagingMem = {};
+    VkBuffer m_stagingBuf[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    VkDeviceSize m_oneStagingSize;
+    // Per-frame staging for the shared texture, holding only the packed
+    // dirty rects. Grows on demand.
+    UploadBuffer m_uploadRing[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    const QImage *m_source = nullptr;
+
+    // In compressed mode m_texImage[0] holds the BC3 copy of the content.
+    // Tiles that are changing live uncompressed in the hot pool instead, the
+    // indirection image tells the shader which one to sample.
+    TileCache m_tileCache;
+    VkImage m_hotImage = VK_NULL_HANDLE;
+    GpuAllocation m_hotMem = {};
+    VkImageView m_hotView = VK_NULL_HANDLE;
+    VkImageLayout m_hotLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImage m_tileImage = VK_NULL_HANDLE;
+    GpuAllocation m_tileMem = {};
+    VkImageView m_tileView = VK_NULL_HANDLE;
+    VkImageLayout m_tileLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // The panels of the scene manager, all in one atlas image and drawn
+    // with one instanced draw.
+    VkImage m_atlasImage = VK_NULL_HANDLE;
+    GpuAllocation m_atlasMem = {};
+    VkImageView m_atlasView = VK_NULL_HANDLE;
+    VkImageLayout m_atlasLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkDescriptorSet m_atlasDescSet = VK_NULL_HANDLE;
+    bool m_atlasNeedsFullUpload = false;
+    UploadBuffer m_panelUpload[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    VkBuffer m_instanceBuf = VK_NULL_HANDLE;
+    GpuAllocation m_instanceBufMem = {};
+    VkDeviceSize m_oneInstanceBufSize = 0;
 
-    VkDeviceMemory m_vertexBufMem = VK_NULL_HANDLE;
+    // Resources that frames still in flight may use, tagged with the frame
+    // they were released in.
+    struct DeferredRelease {
+        enum Type {
+            Image,
+            ImageView,
+            Buffer,
+            Memory
+        };
+        Type type;
+        quint64 frame;
+        union {
+            VkImage image;
+            VkImageView imageView;
+            VkBuffer buffer;
+        };
+        GpuAllocation memory;
+    };
+    QVector<DeferredRelease> m_deferredReleases;
+    quint64 m_frameCount = 0;
+
+    // One copy of the quad per frame, since the texture coordinates depend
+    // on the content size, and an unscaled one for the panels.
+    GpuAllocation m_vertexBufMem = {};
     VkBuffer m_vertexBuf = VK_NULL_HANDLE;
+    VkDeviceSize m_oneVertexBufSize;
+    QSizeF m_vertexUvScale[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
 
     VkDescriptorPool m_descPool = VK_NULL_HANDLE;
     VkDescriptorSetLayout m_descSetLayout = VK_NULL_HANDLE;
@@ -108,9 +274,38 @@ private:
     VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
     VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
     VkPipeline m_pipeline = VK_NULL_HANDLE;
+    VkPipeline m_panelPipeline = VK_NULL_HANDLE;
 
     VkSampler m_sampler = VK_NULL_HANDLE;
 
+    // Two timestamps per frame slot around the render pass, read back when
+    // the slot comes around again.
+    VkQueryPool m_timestampPool = VK_NULL_HANDLE;
+    float m_timestampPeriod = 1;
+    quint64 m_timestampFrame[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+
+    // Signaled once everything submitted up to the end of a frame is done,
+    // indexed by frame number. Only used when limiting the frames in flight.
+    VkFence m_frameFence[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    bool m_frameFencePending[QVulkanWindow::MAX_CONCURRENT_FRAME_COUNT];
+    FramePacer m_pacer;
+    // Set while the next frame waits for its latch time.
+    QTimer m_latchTimer;
+    qint64 m_latchArmed = -1;
+    qint64 m_latchTarget = -1;
+
+    // Damage tracking. The partial render pass keeps what the swapchain
+    // image showed when it was last presented, so only the parts that
+    // changed since then need to be drawn again. state holds everything that
+    // affects the whole image, the history what changed in each frame.
+    static const int DAMAGE_HISTORY_SIZE = 8;
+    VkRenderPass m_partialRenderPass = VK_NULL_HANDLE;
+    VkExtent2D m_renderAreaGranularity;
+    bool m_incrementalPresent = false;
+    QByteArray m_damageState;
+    QRegion m_damageHistory[DAMAGE_HISTORY_SIZE];
+    quint64 m_swapImageFrame[QVulkanWindow::MAX_SWAPCHAIN_BUFFER_COUNT];
+
     QMatrix4x4 m_modelView;
     QMatrix4x4 m_projection;
     QMatrix4x4 m_mvp;
@@ -119,6 +314,14 @@ private:
 class VulkanWindowWithSwQuick : public QVulkanWindow
 {
 public:
+    enum TextureUpload {
+        AutoTextureUpload,
+        LinearTextureUpload,
+        StagingTextureUpload,
+        SharedTextureUpload,
+        CompressedTextureUpload
+    };
+
     VulkanWindowWithSwQuick();
     ~VulkanWindowWithSwQuick();
 
@@ -130,31 +333,172 @@ public:
 
     bool hasQuickSceneChanged() const { return m_quickSceneChanged; }
 
+    // Additional Quick scenes shown as panels in the 3D scene. Created on
+    // first use.
+    QuickSceneManager *sceneManager();
+    bool hasSceneManager() const { return m_sceneManager; }
+
+    void setThreadedQuickRendering(bool enable) { m_threadedQuick = enable; }
+    bool isThreadedQuickRendering() const { return m_threadedQuick; }
+
+    // Rasterizes the Quick scene in bands on the global thread pool. Only
+    // applies when not rendering on a dedicated thread.
+    void setTiledQuickRendering(bool enable) { m_tiledQuick = enable; }
+    bool isTiledQuickRendering() const { return m_tiledQuick; }
+
+    void setTextureUpload(TextureUpload upload) { m_textureUpload = upload; }
+    TextureUpload textureUpload() const { return m_textureUpload; }
+
+    // The format the Quick scene is rendered in and uploaded as, one of
+    // ARGB32_Premultiplied (the default), RGB32, RGB16,
+    // ARGB4444_Premultiplied or Grayscale8. Opaque scenes, and formats
+    // without alpha, are drawn without blending. Both have to be set before
+    // the window is shown.
+    void setQuickImageFormat(QImage::Format format);
+    QImage::Format quickImageFormat() const { return m_quickImageFormat; }
+    void setOpaqueQuick(bool opaque) { m_opaqueQuick = opaque; }
+    bool isOpaqueQuick() const;
+
+    // Mipmaps for the Quick texture, with only the dirty areas regenerated.
+    // Needs staging or shared upload. Anisotropic filtering goes up to the
+    // given degree when the device supports it, 1 turns it off. Both have
+    // to be set before the window is shown.
+    void setQuickMipmaps(bool enable) { m_quickMipmaps = enable; }
+    bool hasQuickMipmaps() const { return m_quickMipmaps; }
+    void setQuickMaxAnisotropy(float max) { m_quickMaxAnisotropy = max; }
+    float quickMaxAnisotropy() const { return m_quickMaxAnisotropy; }
+
+    // Renders the Quick scene, and the panels, at a lower resolution when
+    // their quads cover fewer pixels on screen than the full resolution
+    // images have. The renderer reports the on-screen sizes every frame.
+    void setQuickLodRendering(bool enable);
+    bool isQuickLodRendering() const { return m_quickLodRendering; }
+    void updateQuickFootprint(const QSizeF &pixelSize);
+    qreal quickRenderScale() const { return m_renderScale.scale(); }
+
+    // An empty size makes the Quick scene follow the window size.
+    void setQuickSize(const QSize &size);
+    QSize quickSize() const;
+    bool isQuickSizeFollowingWindow() const { return m_quickSize.isEmpty(); }
+    void setResizeDebounceInterval(int msecs);
+    int resizeDebounceInterval() const;
+
+    // An empty directory disables the on-disk pipeline cache.
+    void setPipelineCacheDirectory(const QString &dir) { m_pipelineCacheDir = dir; }
+    QString pipelineCacheDirectory() const { return m_pipelineCacheDir; }
+
+    FrameProfiler *profiler() { return &m_profiler; }
+    FrameStats lastFrameStats() const { return m_profiler.lastFrameStats(); }
+    // Device memory in use by the renderer, all zero before it is created.
+    GpuMemoryStats gpuMemoryStats() const;
+    // Writes a Chrome trace of the whole run to fileName on destruction.
+    void setTraceFile(const QString &fileName);
+
+    // Limits how many frames are queued up between input and the screen,
+    // from 1 up to concurrentFrameCount(), which is also the default (0).
+    // QVulkanWindow always presents in FIFO mode with a fixed number of
+    // frames in flight, so lower limits are enforced by waiting for older
+    // frames to finish on the GPU. Can be changed at any time.
+    void setMaxFramesInFlight(int count) { m_maxFramesInFlight = count; }
+    int maxFramesInFlight() const { return m_maxFramesInFlight; }
+    // Delays input delivery and the Quick render of each frame to as late as
+    // the measured frame rate and work allow, so that the frame shows the
+    // freshest state. Can be changed at any time.
+    void setLateLatching(bool enable) { m_lateLatching = enable; }
+    bool isLateLatching() const { return m_lateLatching; }
+
+    void setOnDemandRendering(bool enable);
+    bool isOnDemandRendering() const { return m_onDemand; }
+    // Redraws only the parts of the window that changed while the 3D state
+    // stays the same, and passes them on with VK_KHR_incremental_present
+    // where supported. Has to be set before the window is shown.
+    void setDamageTracking(bool enable);
+    bool isDamageTracking() const { return m_damageTracking; }
+    void setKeepAliveInterval(int msecs);
+    int keepAliveInterval() const { return m_keepAliveInterval; }
+
+    // Sends the input queued since the last frame. Called by the renderer
+    // before the Quick scene is polished.
+    void deliverPendingInput();
+
     QImage *renderQuickImage(QRegion *dirtyRegion);
+    bool requestQuickImage();
+    const QImage *takeQuickImage(QRegion *dirtyRegion);
 
 private slots:
     void createQuickImage();
     void resizeQuickImage();
+    void applyWindowSize();
     void onScreenChanged();
+    void onQuickSceneChanged();
+    void onSceneGraphChanged();
     void runQuick();
 
 private:
-    //void resizeEvent(QResizeEvent *) override;
+    void resizeEvent(QResizeEvent *) override;
+    void exposeEvent(QExposeEvent *) override;
     void updateQuickSizes();
+    void updateKeepAliveTimer();
+    void watchSceneGraph();
+    qreal quickRenderDpr() const { return m_dpr * m_renderScale.scale(); }
 
     bool event(QEvent *) override;
+    bool quickWindowQuad(QQuickWindow *window, QMatrix4x4 *mvp, QSizeF *size) const;
+    bool pickQuickWindow(const QPointF &pos, QQuickWindow *grab, QQuickWindow **window, QPointF *scenePos) const;
+    void queueInputEvent(QEvent *e);
+    void deliverInputEvent(QEvent *e);
+    bool deliverMouseEvent(QMouseEvent *me);
+    bool deliverTouchEvent(QTouchEvent *te);
+    bool deliverWheelEvent(QWheelEvent *we);
+    void setHoverWindow(QQuickWindow *window);
+    void setKeyFocusWindow(QQuickWindow *window);
+    QQuickWindow *keyFocusWindow() const;
 
-    VulkanRenderer *m_renderer;
+    VulkanRenderer *m_renderer = nullptr;
     QQuickRenderControl *m_renderControl;
     QQuickWindow *m_quickWindow;
     QQmlEngine *m_qmlEngine;
     QQmlComponent *m_qmlComponent = nullptr;
     QQuickItem *m_rootItem = nullptr;
-    qreal m_dpr;
+    qreal m_dpr = 0;
+    QSize m_quickSize;
+    QSize m_followedSize;
+    QTimer *m_resizeTimer;
     QImage m_quickImage;
+    QuickRenderThread *m_quickRenderThread = nullptr;
+    bool m_threadedQuick = false;
+    TiledQuickRenderer *m_tiledRenderer = nullptr;
+    bool m_tiledQuick = false;
+    TextureUpload m_textureUpload = AutoTextureUpload;
+    QImage::Format m_quickImageFormat = QImage::Format_ARGB32_Premultiplied;
+    bool m_opaqueQuick = false;
+    bool m_quickMipmaps = false;
+    float m_quickMaxAnisotropy = 1;
+    bool m_quickLodRendering = false;
+    RenderScaleController m_renderScale;
+    bool m_quickImageFresh = false;
+    QString m_pipelineCacheDir;
+    FrameProfiler m_profiler;
+    QString m_traceFile;
+    QuickSceneManager *m_sceneManager = nullptr;
+    bool m_onDemand = false;
+    bool m_damageTracking = false;
+    int m_maxFramesInFlight = 0;
+    bool m_lateLatching = false;
+    int m_keepAliveInterval = 0;
+    QTimer *m_keepAliveTimer;
     bool m_quickRunning = false;
     bool m_quickStarted = false;
     bool m_quickSceneChanged = false;
+    QSGRenderer *m_watchedRenderer = nullptr;
+    bool m_sceneGraphChanged = true;
+    // The main scene's window or a panel's, panels can go away at any time.
+    QPointer<QQuickWindow> m_mouseGrab;
+    QPointer<QQuickWindow> m_touchGrab;
+    QPointer<QQuickWindow> m_hoverWindow;
+    QPointer<QQuickWindow> m_keyFocus;
+    QVector<QEvent *> m_inputQueue;
+    qint64 m_oldestInput = 0;
 };
 
 #endif